@@ -0,0 +1,306 @@
+#include "compress_cache.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+
+// 用到的zlib类型和常量在这里按zlib 1.x的ABI声明，编译时不需要zlib的开发头文件。
+// z_stream的布局在1.x中没有变过，deflateInit2_()会检查版本号的主版本和结构体大小，不匹配时返回错误
+struct z_stream
+{
+    const unsigned char *next_in;
+    unsigned int avail_in;
+    unsigned long total_in;
+    unsigned char *next_out;
+    unsigned int avail_out;
+    unsigned long total_out;
+    const char *msg;
+    void *state;
+    void *zalloc; // NULL表示使用zlib默认的malloc/free
+    void *zfree;
+    void *opaque;
+    int data_type;
+    unsigned long adler;
+    unsigned long reserved;
+};
+
+static const int Z_OK = 0;
+static const int Z_STREAM_END = 1;
+static const int Z_FINISH = 4;
+static const int Z_DEFLATED = 8;
+static const int Z_DEFAULT_STRATEGY = 0;
+static const char ZLIB_VERSION[] = "1.2.11";
+
+// 运行时从libz.so.1中取得的函数，进程内只加载一次
+static int (*z_deflate_init2)(z_stream *, int, int, int, int, int, const char *, int) = NULL;
+static int (*z_deflate)(z_stream *, int) = NULL;
+static int (*z_deflate_end)(z_stream *) = NULL;
+
+static bool load_zlib()
+{
+    if (z_deflate_init2)
+    {
+        return true;
+    }
+    void *lib = dlopen("libz.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!lib)
+    {
+        return false;
+    }
+    z_deflate_init2 = (int (*)(z_stream *, int, int, int, int, int, const char *, int))dlsym(lib, "deflateInit2_");
+    z_deflate = (int (*)(z_stream *, int))dlsym(lib, "deflate");
+    z_deflate_end = (int (*)(z_stream *))dlsym(lib, "deflateEnd");
+    if (!z_deflate_init2 || !z_deflate || !z_deflate_end)
+    {
+        z_deflate_init2 = NULL;
+        dlclose(lib);
+        return false;
+    }
+    return true;
+}
+
+compress_cache::compress_cache(size_t mem_budget)
+    : m_mem_budget(mem_budget), m_bytes(0), m_stop(false), m_started(false)
+{
+}
+
+compress_cache::~compress_cache()
+{
+    if (m_started)
+    {
+        m_locker.lock();
+        m_stop = true;
+        m_cond.signal();
+        m_locker.unlock();
+        pthread_join(m_thread, NULL);
+    }
+    for (std::unordered_map<variant::key, variant *, variant::key_hash>::iterator it = m_variants.begin();
+         it != m_variants.end(); ++it)
+    {
+        free(it->second->data);
+        delete it->second;
+    }
+}
+
+bool compress_cache::start()
+{
+    if (!load_zlib())
+    {
+        return false;
+    }
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        return false;
+    }
+    m_started = true;
+    return true;
+}
+
+compress_cache::variant *compress_cache::acquire(const char *path, const struct stat &st)
+{
+    if (st.st_size < MIN_FILE_SIZE || st.st_size > MAX_FILE_SIZE)
+    {
+        return NULL;
+    }
+
+    variant::key k;
+    k.dev = st.st_dev;
+    k.ino = st.st_ino;
+    k.size = st.st_size;
+    k.mtime_sec = st.st_mtim.tv_sec;
+    k.mtime_nsec = st.st_mtim.tv_nsec;
+
+    m_locker.lock();
+    std::unordered_map<variant::key, variant *, variant::key_hash>::iterator it = m_variants.find(k);
+    if (it != m_variants.end())
+    {
+        variant *v = it->second;
+        // 还在压缩，或者压缩后没有变小
+        if (v->m_pending || !v->data)
+        {
+            m_locker.unlock();
+            return NULL;
+        }
+        if (v->m_idle)
+        {
+            m_lru.erase(v->m_lru_pos);
+            v->m_idle = false;
+        }
+        ++v->m_refcount;
+        m_locker.unlock();
+        return v;
+    }
+
+    // 第一次请求这个文件，放一个占位的缓存项，后面的请求不会重复排队
+    if (m_jobs.size() < MAX_PENDING)
+    {
+        variant *v = new variant;
+        v->data = NULL;
+        v->size = 0;
+        v->m_key = k;
+        v->m_refcount = 0;
+        v->m_pending = true;
+        v->m_idle = false;
+        m_variants[k] = v;
+
+        job j;
+        j.path = path;
+        j.st = st;
+        j.v = v;
+        m_jobs.push_back(j);
+        m_cond.signal();
+    }
+    m_locker.unlock();
+    return NULL;
+}
+
+void compress_cache::release(variant *v)
+{
+    m_locker.lock();
+    if (--v->m_refcount == 0)
+    {
+        v->m_idle = true;
+        m_lru.push_front(v);
+        v->m_lru_pos = m_lru.begin();
+        evict();
+    }
+    m_locker.unlock();
+}
+
+void compress_cache::evict()
+{
+    while (!m_lru.empty() && (m_bytes > m_mem_budget || m_variants.size() > MAX_ENTRIES))
+    {
+        variant *v = m_lru.back();
+        m_lru.pop_back();
+        m_variants.erase(v->m_key);
+        m_bytes -= v->size;
+        free(v->data);
+        delete v;
+    }
+}
+
+// 打开的文件和请求时stat的文件是同一个版本
+static bool same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+bool compress_cache::compress(const job &j, char **data, off_t *size)
+{
+    int fd = open(j.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    // 请求时的stat结果可能已经过期：文件被截短时映射会在读到末尾之后触发SIGBUS，
+    // 被改写时新内容会存到旧的身份下。打开的文件必须和缓存项的身份完全一致，
+    // 并且用pread读入而不是映射，读的过程中文件再被截短也只是读到的字节变少
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !same_file(st, j.st))
+    {
+        close(fd);
+        return false;
+    }
+    char *in = (char *)malloc(j.st.st_size);
+    off_t got = 0;
+    while (in && got < j.st.st_size)
+    {
+        ssize_t n = pread(fd, in + got, j.st.st_size - got, got);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        got += n;
+    }
+    // 读的过程中被改写的文件修改时间会变化
+    bool changed = fstat(fd, &st) < 0 || !same_file(st, j.st);
+    close(fd);
+    if (changed || got != j.st.st_size)
+    {
+        free(in);
+        return false;
+    }
+
+    // 输出缓冲区只有原文件的90%，放不下说明压缩不值得
+    off_t limit = j.st.st_size - j.st.st_size / 10;
+    char *out = (char *)malloc(limit);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    bool ok = false;
+    // windowBits加16生成gzip格式
+    if (out && z_deflate_init2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY, ZLIB_VERSION, sizeof(zs)) == Z_OK)
+    {
+        zs.next_in = (const unsigned char *)in;
+        zs.avail_in = j.st.st_size;
+        zs.next_out = (unsigned char *)out;
+        zs.avail_out = limit;
+        ok = z_deflate(&zs, Z_FINISH) == Z_STREAM_END;
+        z_deflate_end(&zs);
+    }
+    free(in);
+
+    if (!ok)
+    {
+        free(out);
+        return false;
+    }
+    *size = zs.total_out;
+    *data = (char *)realloc(out, zs.total_out);
+    return true;
+}
+
+void *compress_cache::worker(void *arg)
+{
+    compress_cache *cache = (compress_cache *)arg;
+    cache->run();
+    return cache;
+}
+
+void compress_cache::run()
+{
+    m_locker.lock();
+    while (true)
+    {
+        while (m_jobs.empty() && !m_stop)
+        {
+            m_cond.wait(m_locker.get());
+        }
+        if (m_stop)
+        {
+            break;
+        }
+        job j = m_jobs.front();
+        m_jobs.pop_front();
+        m_locker.unlock();
+
+        char *data = NULL;
+        off_t size = 0;
+        if (!compress(j, &data, &size))
+        {
+            LOG_DEBUG("%s changed or is not worth compressing", j.path.c_str());
+        }
+
+        m_locker.lock();
+        // 压缩没有成功的文件也保留缓存项，不再反复尝试，直到被淘汰
+        variant *v = j.v;
+        v->data = data;
+        v->size = size;
+        make_validators(j.st, &v->validators, "-gz");
+        v->m_pending = false;
+        v->m_idle = true;
+        m_lru.push_front(v);
+        v->m_lru_pos = m_lru.begin();
+        m_bytes += size;
+        evict();
+    }
+    m_locker.unlock();
+}
@@ -0,0 +1,121 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <deque>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "lock.h"
+#include "http_response.h"
+
+// 文件的gzip压缩版本的缓存，由所有工作线程共享。
+// 请求的文件还没有压缩版本时，acquire()把它交给后台的压缩线程后立即返回，触发的请求照常发送未压缩的内容，
+// 压缩完成之后的请求才得到压缩版本，工作线程从不等待压缩。
+// 压缩版本按文件的身份(设备、inode、大小、修改时间)缓存，文件被修改后自然对应新的缓存项；
+// 引用计数为0的版本按LRU顺序保留，总字节数超过上限时淘汰最久未用的版本。
+// zlib在运行时用dlopen加载，用到的类型和常量在compress_cache.cpp中自行声明，编译和链接都不需要zlib，加载失败时start()返回false
+class compress_cache
+{
+public:
+    // 小于该大小的文件压缩后节省的字节不抵gzip的头部开销，大于该大小的文件压缩太久，都不压缩
+    static const off_t MIN_FILE_SIZE = 256;
+    static const off_t MAX_FILE_SIZE = 8 * 1024 * 1024;
+    // 等待压缩的文件数上限，队列满时新的文件这次不压缩，下次请求时再尝试
+    static const size_t MAX_PENDING = 256;
+    // 最多缓存的版本数，包括压缩后没有变小而不再尝试的文件
+    static const size_t MAX_ENTRIES = 4096;
+
+    struct variant
+    {
+        char *data; // gzip格式的内容，压缩后没有变小的文件为NULL
+        off_t size;
+        file_validators validators; // ETag在原文件的基础上加了"-gz"后缀，和未压缩的版本区分
+
+    private:
+        friend class compress_cache;
+
+        // 文件的身份
+        struct key
+        {
+            dev_t dev;
+            ino_t ino;
+            off_t size;
+            time_t mtime_sec;
+            long mtime_nsec;
+
+            bool operator==(const key &other) const
+            {
+                return dev == other.dev && ino == other.ino && size == other.size &&
+                       mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+            }
+        };
+        struct key_hash
+        {
+            size_t operator()(const key &k) const
+            {
+                size_t h = k.ino;
+                h = h * 31 + k.dev;
+                h = h * 31 + k.size;
+                h = h * 31 + k.mtime_sec;
+                h = h * 31 + k.mtime_nsec;
+                return h;
+            }
+        };
+
+        key m_key;
+        int m_refcount;
+        bool m_pending;                           // 还在等待压缩，data无效
+        bool m_idle;                              // 引用计数为0，位于LRU链表中
+        std::list<variant *>::iterator m_lru_pos; // 在LRU链表中的位置
+    };
+
+    // mem_budget为压缩版本最多占用的字节数
+    explicit compress_cache(size_t mem_budget);
+    ~compress_cache();
+
+    // 加载zlib并启动压缩线程，失败返回false
+    bool start();
+
+    // 获取文件的压缩版本，path和st为do_request得到的完整路径和stat结果。
+    // 已经压缩好时增加引用计数并返回；否则必要时把文件放进压缩队列，返回NULL
+    variant *acquire(const char *path, const struct stat &st);
+
+    // 释放acquire得到的版本
+    void release(variant *v);
+
+private:
+    struct job
+    {
+        std::string path;
+        struct stat st;
+        variant *v; // 占位的缓存项，压缩完成后填入内容
+    };
+
+    // 压缩一个文件，在不持有锁的情况下调用。文件已经不是j.st描述的版本，或者压缩后没有变小时返回false
+    bool compress(const job &j, char **data, off_t *size);
+
+    // 淘汰空闲的版本直到不超过上限，调用时持有锁
+    void evict();
+
+    static void *worker(void *arg);
+    void run();
+
+private:
+    size_t m_mem_budget;
+
+    locker m_locker;
+    cond m_cond; // 有新的压缩任务，或者要求停止
+    std::deque<job> m_jobs;
+    std::unordered_map<variant::key, variant *, variant::key_hash> m_variants;
+    std::list<variant *> m_lru; // 空闲的版本，表头是最近释放的
+    size_t m_bytes;             // 所有压缩版本占用的字节数
+    bool m_stop;
+
+    bool m_started;
+    pthread_t m_thread;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "config.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+server_config::server_config()
+{
+    port = 0;
+    reactor_num = 1; // 默认单reactor，与原来的行为一致
+    io_uring = false;
+    sendfile_threshold = 64 * 1024;
+    stat_cache_size = 1024;
+    file_cache_mb = 64;
+    compress_cache_mb = 16;
+    backlog = 1024;
+    accept_batch = 128;
+    work_stealing = false;
+    log_file = NULL;
+    doc_root = NULL;
+    timeouts[0] = 20;
+    timeouts[1] = 30;
+    timeouts[2] = 30;
+    timeouts[3] = 60;
+}
+
+bool server_config::parse_arg(int argc, char *argv[])
+{
+    int opt;
+    const char *str = "r:i:s:c:m:z:b:a:w:t:l:d:";
+    while ((opt = getopt(argc, argv, str)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            reactor_num = atoi(optarg);
+            break;
+        case 'i':
+            if (strcmp(optarg, "uring") == 0)
+            {
+                io_uring = true;
+            }
+            else if (strcmp(optarg, "epoll") != 0)
+            {
+                return false;
+            }
+            break;
+        case 's':
+            sendfile_threshold = atol(optarg);
+            break;
+        case 'c':
+            stat_cache_size = atoi(optarg);
+            break;
+        case 'm':
+            file_cache_mb = atoi(optarg);
+            break;
+        case 'z':
+            compress_cache_mb = atoi(optarg);
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            break;
+        case 'a':
+            accept_batch = atoi(optarg);
+            break;
+        case 'w':
+            if (strcmp(optarg, "steal") == 0)
+            {
+                work_stealing = true;
+            }
+            else if (strcmp(optarg, "global") != 0)
+            {
+                return false;
+            }
+            break;
+        case 'l':
+            log_file = optarg;
+            break;
+        case 'd':
+            doc_root = optarg;
+            break;
+        case 't':
+        {
+            // 逗号分隔，可以只给出前几个
+            const char *p = optarg;
+            for (int i = 0; i < 4 && *p; ++i)
+            {
+                char *end;
+                timeouts[i] = strtol(p, &end, 10);
+                if (end == p || timeouts[i] < 0 || (*end != ',' && *end != '\0'))
+                {
+                    return false;
+                }
+                p = *end == ',' ? end + 1 : end;
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // 剩下的第一个非选项参数为端口号
+    if (optind >= argc)
+    {
+        return false;
+    }
+    port = atoi(argv[optind]);
+
+    if (reactor_num == 0)
+    {
+        reactor_num = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return port > 0 && reactor_num > 0 && sendfile_threshold >= 0 && stat_cache_size >= 0 && file_cache_mb >= 0 &&
+           compress_cache_mb >= 0 && backlog > 0 && accept_batch > 0;
+}
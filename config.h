@@ -0,0 +1,30 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// 服务器运行参数，由命令行解析得到
+struct server_config
+{
+    int port;        // 监听端口
+    int reactor_num; // reactor线程数，每个线程拥有独立的epoll和SO_REUSEPORT监听socket，0表示与CPU核数相同
+    bool io_uring;   // 使用io_uring代替epoll完成accept和读写，内核不支持时自动回退到epoll
+    long sendfile_threshold; // 不小于该字节数的文件用sendfile发送，小文件仍然mmap后writev
+    int stat_cache_size;     // 文件状态缓存最多缓存的URL个数，0表示不使用缓存
+    int file_cache_mb;       // 空闲的文件映射最多占用的内存(MB)，超出后按LRU淘汰
+    int compress_cache_mb;   // 文件的gzip压缩版本最多占用的内存(MB)，0表示只发送预先压缩好的.gz/.br文件
+    int backlog;             // 监听队列的长度，实际上限还受net.core.somaxconn限制
+    int accept_batch;        // 每次监听socket就绪时最多接受的连接数
+    bool work_stealing;      // 线程池使用每线程队列加工作窃取的调度，连接交还给上次处理它的线程
+    const char *log_file;    // 日志文件，NULL表示写到标准输出
+    const char *doc_root;    // 网站根目录，NULL表示使用编译时的默认目录
+    int timeouts[4];         // 头部、请求体、发送、长连接空闲的超时秒数(顺序同timeout_kind)，0表示不限制
+
+    server_config();
+
+    // 解析命令行参数: port_number [-r reactor_number] [-i epoll|uring] [-s sendfile_threshold] [-c stat_cache_size] [-m file_cache_mb]
+    //                   [-z compress_cache_mb] [-b backlog] [-a accept_batch] [-w global|steal] [-t header,body,write,idle] [-l log_file]
+    //                   [-d doc_root]
+    // 成功返回true，参数有误返回false
+    bool parse_arg(int argc, char *argv[]);
+};
+
+#endif
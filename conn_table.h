@@ -0,0 +1,63 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <atomic>
+#include "http_conn.h"
+
+// 以文件描述符为下标的连接表。连接对象按块分配，只有用到过的文件描述符所在的块才会分配，
+// 启动时只需要一个块指针数组，文件描述符上限很大时也不会预先占用内存。
+// 块分配后一直保留，新连接复用同一个文件描述符时复用同一个对象
+class conn_table
+{
+public:
+    static const int CONNS_PER_BLOCK = 256;
+
+    explicit conn_table(int max_fd) : m_max_fd(max_fd), m_block_count((max_fd + CONNS_PER_BLOCK - 1) / CONNS_PER_BLOCK)
+    {
+        m_blocks = new std::atomic<http_conn *>[m_block_count];
+        for (int i = 0; i < m_block_count; ++i)
+        {
+            m_blocks[i].store(NULL, std::memory_order_relaxed);
+        }
+    }
+
+    ~conn_table()
+    {
+        for (int i = 0; i < m_block_count; ++i)
+        {
+            delete[] m_blocks[i].load(std::memory_order_relaxed);
+        }
+        delete[] m_blocks;
+    }
+
+    int max_fd() const { return m_max_fd; }
+
+    // 文件描述符对应的连接，所在的块还没有分配时先分配。多个reactor可能同时接受同一个块中的连接，用CAS决定谁的块生效
+    http_conn *get(int fd)
+    {
+        std::atomic<http_conn *> &slot = m_blocks[fd / CONNS_PER_BLOCK];
+        http_conn *block = slot.load(std::memory_order_acquire);
+        if (!block)
+        {
+            http_conn *fresh = new http_conn[CONNS_PER_BLOCK];
+            if (slot.compare_exchange_strong(block, fresh, std::memory_order_acq_rel))
+            {
+                block = fresh;
+            }
+            else
+            {
+                delete[] fresh;
+            }
+        }
+        return block + fd % CONNS_PER_BLOCK;
+    }
+
+    http_conn &operator[](int fd) { return *get(fd); }
+
+private:
+    int m_max_fd;
+    int m_block_count;
+    std::atomic<http_conn *> *m_blocks;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "conn_timers.h"
+#include "http_conn.h"
+
+int conn_timers::m_timeouts[TIMEOUT_KINDS] = {20, 30, 30, 60};
+
+conn_timers::conn_timers() : m_wheel(monotonic_sec()), m_timerfd(-1) {}
+
+conn_timers::~conn_timers()
+{
+    if (m_timerfd >= 0)
+    {
+        close(m_timerfd);
+    }
+}
+
+bool conn_timers::init()
+{
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd < 0)
+    {
+        return false;
+    }
+    // 每秒触发一次
+    struct itimerspec its;
+    its.it_value.tv_sec = 1;
+    its.it_value.tv_nsec = 0;
+    its.it_interval = its.it_value;
+    return timerfd_settime(m_timerfd, 0, &its, NULL) == 0;
+}
+
+void conn_timers::add(wheel_timer *timer, int deadline)
+{
+    m_lock.lock();
+    m_wheel.add(timer, deadline);
+    m_lock.unlock();
+}
+
+void conn_timers::del(wheel_timer *timer)
+{
+    m_lock.lock();
+    m_wheel.del(timer);
+    m_lock.unlock();
+}
+
+int conn_timers::count()
+{
+    m_lock.lock();
+    int n = m_wheel.count();
+    m_lock.unlock();
+    return n;
+}
+
+int conn_timers::tick()
+{
+    // io_uring模式下到期次数已经由ring读走，这里读不到数据也没有关系
+    unsigned long long expirations;
+    ssize_t ret = read(m_timerfd, &expirations, sizeof(expirations));
+    (void)ret;
+
+    int now = monotonic_sec();
+    int closed = 0;
+    // 回调在持有锁时执行：连接关闭时先在锁内删除定时器再关闭socket，
+    // 所以回调中看到的连接一定还没有关闭，shutdown不会作用到被复用的文件描述符上
+    m_lock.lock();
+    m_wheel.advance(now, [&](wheel_timer *timer) {
+        http_conn *conn = (http_conn *)timer->data;
+        int deadline = conn->deadline();
+        if (deadline > now)
+        {
+            // 到期前连接上有过活动，按新的截止时间放回去
+            m_wheel.add(timer, deadline);
+        }
+        else
+        {
+            conn->expire();
+            ++closed;
+        }
+    });
+    m_lock.unlock();
+    if (closed > 0)
+    {
+        metrics::count(COUNTER_TIMEOUTS, closed);
+    }
+    return closed;
+}
@@ -0,0 +1,68 @@
+#ifndef CONN_TIMERS_H
+#define CONN_TIMERS_H
+
+#include <time.h>
+#include <climits>
+#include "lock.h"
+#include "timing_wheel.h"
+
+// 连接的超时类型
+enum timeout_kind
+{
+    TIMEOUT_HEADER = 0, // 从请求的第一个字节到头部收完，不因收到数据而延长，防止slowloris
+    TIMEOUT_BODY,       // 请求体两次收到数据的最大间隔
+    TIMEOUT_WRITE,      // 响应发送没有进展(socket发送缓冲区一直是满的)的最长时间
+    TIMEOUT_IDLE,       // 长连接两个请求之间的最长空闲时间，新连接等待第一个请求也用它
+    TIMEOUT_KINDS
+};
+
+// 没有截止时间
+static const int NO_DEADLINE = INT_MAX;
+
+// 单调时钟的秒数。COARSE时钟直接读取上次时钟中断时的时间，开销比普通的clock_gettime更小，精度对秒级的超时足够了
+inline int monotonic_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+// 每个reactor一个的连接超时管理。连接关闭前一直在时间轮中，每个连接嵌入一个定时器节点，不单独分配内存。
+// 连接上的活动只修改连接自己记录的截止时间(http_conn::set_deadline)，不操作时间轮；
+// 定时器到期时再对照连接当前的截止时间，还没到就按新的截止时间重新放回时间轮，所以刷新超时是O(1)的一次写入。
+// timerfd每秒触发一次，注册在reactor的epoll(或者io_uring)中，到期的连接在一次tick中批量处理：
+// 只对socket调用shutdown，由正常的读写出错路径关闭连接，不会和正在处理该连接的工作线程冲突。
+// 工作线程也可能关闭连接，所以时间轮由互斥锁保护；只有建立、关闭连接和tick时才需要加锁
+class conn_timers
+{
+public:
+    // 各种超时的秒数，小于等于0表示不限制，由main()根据命令行设置
+    static int m_timeouts[TIMEOUT_KINDS];
+
+    conn_timers();
+    ~conn_timers();
+
+    // 创建timerfd，失败返回false
+    bool init();
+
+    // 注册到epoll或者io_uring中的timerfd
+    int fd() const { return m_timerfd; }
+
+    // 把定时器加入时间轮，deadline为monotonic_sec()的秒数
+    void add(wheel_timer *timer, int deadline);
+    // 连接关闭时删除定时器，必须在关闭socket之前调用
+    void del(wheel_timer *timer);
+
+    // timerfd可读时调用，处理所有到期的连接，返回被关闭的连接数
+    int tick();
+
+    // 时间轮中的连接数
+    int count();
+
+private:
+    locker m_lock;
+    timing_wheel m_wheel;
+    int m_timerfd;
+};
+
+#endif
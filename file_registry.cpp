@@ -0,0 +1,171 @@
+#include "file_registry.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+file_registry::file_registry(size_t mem_budget, int max_files)
+    : m_mem_budget(mem_budget), m_max_files(max_files), m_mapped_bytes(0), m_open_files(0)
+{
+}
+
+file_registry::~file_registry()
+{
+    for (std::unordered_map<file::key, file *, file::key_hash>::iterator it = m_files.begin(); it != m_files.end(); ++it)
+    {
+        unload(it->second);
+        delete it->second;
+    }
+}
+
+file_registry::file *file_registry::acquire(const char *path, const struct stat &st, bool use_sendfile)
+{
+    file::key k;
+    k.dev = st.st_dev;
+    k.ino = st.st_ino;
+    k.size = st.st_size;
+    k.mtime_sec = st.st_mtim.tv_sec;
+    k.mtime_nsec = st.st_mtim.tv_nsec;
+
+    m_locker.lock();
+    std::unordered_map<file::key, file *, file::key_hash>::iterator it = m_files.find(k);
+    if (it != m_files.end())
+    {
+        // 其他线程正在打开这个文件，等待它完成
+        while (it != m_files.end() && it->second->m_loading)
+        {
+            m_loaded.wait(m_locker.get());
+            it = m_files.find(k);
+        }
+        if (it == m_files.end())
+        {
+            // 加载失败了
+            m_locker.unlock();
+            return NULL;
+        }
+
+        file *f = it->second;
+        if (f->m_idle)
+        {
+            m_lru.erase(f->m_lru_pos);
+            f->m_idle = false;
+        }
+        ++f->m_refcount;
+        m_locker.unlock();
+        return f;
+    }
+
+    // 第一个请求该文件的线程负责打开它，打开期间不持有锁
+    file *f = new file;
+    f->addr = NULL;
+    f->fd = -1;
+    f->size = st.st_size;
+    f->m_key = k;
+    f->m_refcount = 1;
+    f->m_loading = true;
+    f->m_idle = false;
+    m_files[k] = f;
+    m_locker.unlock();
+
+    bool ok = load(f, path, use_sendfile);
+
+    m_locker.lock();
+    f->m_loading = false;
+    if (ok)
+    {
+        m_mapped_bytes += f->addr ? f->size : 0;
+        m_open_files += f->fd != -1 ? 1 : 0;
+    }
+    else
+    {
+        m_files.erase(k);
+    }
+    m_loaded.broadcast();
+    m_locker.unlock();
+
+    if (!ok)
+    {
+        delete f;
+        return NULL;
+    }
+    return f;
+}
+
+void file_registry::release(file *f)
+{
+    m_locker.lock();
+    if (--f->m_refcount == 0)
+    {
+        f->m_idle = true;
+        m_lru.push_front(f);
+        f->m_lru_pos = m_lru.begin();
+        evict();
+    }
+    m_locker.unlock();
+}
+
+void file_registry::evict()
+{
+    while (!m_lru.empty() && (m_mapped_bytes > m_mem_budget || m_open_files > m_max_files))
+    {
+        file *f = m_lru.back();
+        m_lru.pop_back();
+        m_files.erase(f->m_key);
+        m_mapped_bytes -= f->addr ? f->size : 0;
+        m_open_files -= f->fd != -1 ? 1 : 0;
+        unload(f);
+        delete f;
+    }
+}
+
+bool file_registry::load(file *f, const char *path, bool use_sendfile)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // 调用者的stat结果可能来自缓存，已经过期：文件被改写后新内容会以旧的身份发送，
+    // 被截短后映射读到末尾之后触发SIGBUS。打开的文件必须就是键描述的那个版本，否则让调用者重新stat
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_dev != f->m_key.dev || st.st_ino != f->m_key.ino ||
+        st.st_size != f->m_key.size || st.st_mtim.tv_sec != f->m_key.mtime_sec ||
+        st.st_mtim.tv_nsec != f->m_key.mtime_nsec)
+    {
+        close(fd);
+        return false;
+    }
+
+    // sendfile通过偏移量参数发送，不改变文件描述符自身的偏移，所以可以被多个连接共用
+    if (use_sendfile)
+    {
+        f->fd = fd;
+        return true;
+    }
+
+    // 空文件不需要映射
+    if (f->size > 0)
+    {
+        void *addr = mmap(0, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        f->addr = (char *)addr;
+    }
+    close(fd);
+    return true;
+}
+
+void file_registry::unload(file *f)
+{
+    if (f->addr)
+    {
+        munmap(f->addr, f->size);
+    }
+    if (f->fd != -1)
+    {
+        close(f->fd);
+    }
+}
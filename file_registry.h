@@ -0,0 +1,92 @@
+#ifndef FILE_REGISTRY_H
+#define FILE_REGISTRY_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <list>
+#include <unordered_map>
+#include "lock.h"
+
+// 进程内共享的文件映射注册表。每个文件只映射(大文件只打开)一次，由引用计数管理，
+// 所有正在发送该文件的连接共用同一份映射。多个线程同时请求同一个未缓存的文件时，
+// 只有一个线程去打开和映射，其余线程等待它完成。
+// 引用计数为0的文件按LRU顺序保留，映射的总字节数或打开的文件数超过上限时淘汰最久未用的文件。
+class file_registry
+{
+public:
+    struct file
+    {
+        char *addr; // 映射的起始地址，sendfile模式下为NULL
+        int fd;     // sendfile模式下打开的文件描述符，否则为-1
+        off_t size; // 文件大小
+
+    private:
+        friend class file_registry;
+
+        // 文件的身份，文件被修改后大小或修改时间会变化，从而对应新的缓存项
+        struct key
+        {
+            dev_t dev;
+            ino_t ino;
+            off_t size;
+            time_t mtime_sec;
+            long mtime_nsec;
+
+            bool operator==(const key &other) const
+            {
+                return dev == other.dev && ino == other.ino && size == other.size &&
+                       mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+            }
+        };
+        struct key_hash
+        {
+            size_t operator()(const key &k) const
+            {
+                size_t h = k.ino;
+                h = h * 31 + k.dev;
+                h = h * 31 + k.size;
+                h = h * 31 + k.mtime_sec;
+                h = h * 31 + k.mtime_nsec;
+                return h;
+            }
+        };
+
+        key m_key;
+        int m_refcount;
+        bool m_loading;                        // 正在由某个线程打开
+        bool m_idle;                           // 引用计数为0，位于LRU链表中
+        std::list<file *>::iterator m_lru_pos; // 在LRU链表中的位置
+    };
+
+    // mem_budget为空闲映射最多占用的字节数，max_files为最多保持打开的大文件数
+    file_registry(size_t mem_budget, int max_files);
+    ~file_registry();
+
+    // 获取文件，path和st为do_request得到的完整路径和stat结果，
+    // use_sendfile为true时只打开文件不做映射。打开失败，或者打开的文件已经和st不符时返回NULL，调用者应重新stat
+    file *acquire(const char *path, const struct stat &st, bool use_sendfile);
+
+    // 释放acquire得到的文件
+    void release(file *f);
+
+private:
+    // 打开并映射文件，在不持有锁的情况下调用
+    static bool load(file *f, const char *path, bool use_sendfile);
+    static void unload(file *f);
+
+    // 淘汰空闲文件直到不超过上限，调用时持有锁
+    void evict();
+
+private:
+    size_t m_mem_budget;
+    int m_max_files;
+
+    locker m_locker;
+    cond m_loaded; // 有文件加载完成
+    std::unordered_map<file::key, file *, file::key_hash> m_files;
+    std::list<file *> m_lru; // 空闲文件，表头是最近释放的
+    size_t m_mapped_bytes;   // 所有映射占用的字节数
+    int m_open_files;        // 保持打开的文件数
+};
+
+#endif
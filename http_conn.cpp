@@ -1,37 +1,43 @@
 #include "http_conn.h"
+#include "uring.h"
 
-// 定义HTTP响应的一些状态信息
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+// 用户数量
+std::atomic<int> http_conn::m_user_count(0);
 
-// 所有的socket上的事件都被注册到同一个epoll内核事件表
-int http_conn::m_epollfd = -1;
+// 大文件的阈值，可以通过命令行修改
+off_t http_conn::m_sendfile_threshold = 64 * 1024;
 
-// 用户数量
-int http_conn::m_user_count = 0;
+// 文件状态缓存，由main()创建
+stat_cache *http_conn::m_stat_cache = NULL;
+
+// 文件映射注册表，由main()创建
+file_registry *http_conn::m_file_registry = NULL;
+
+// 压缩缓存，由main()创建
+compress_cache *http_conn::m_compress_cache = NULL;
+
+// 读缓冲区的slab池，由main()创建
+slab_pool *http_conn::m_slab_pool = NULL;
+
+// 处理请求时借用的缓冲区池，由main()创建
+object_pool<http_conn::conn_buffers> *http_conn::m_buffer_pool = NULL;
+
+// 运行统计的保留URL
+const char http_conn::METRICS_URL[] = "/__metrics";
+const char http_conn::METRICS_PROMETHEUS_URL[] = "/__metrics/prometheus";
 
 
 // 网站的根目录
 const char* doc_root = "/home/cos/Documents/LinuxWebServer/resources";
 
-http_conn::http_conn() {}
-http_conn::~http_conn() {}
-
-void setnonblocking(int fd)
+http_conn::http_conn() : m_buf(NULL), m_file_fd(-1), m_worker(-1), m_file_count(0), m_file_address(0), m_timers(NULL),
+                         m_deadline(NO_DEADLINE), m_request_started(false)
 {
-    int old_flag = fcntl(fd, F_GETFL);
-    int new_flag = old_flag | O_NONBLOCK; // 设置非阻塞模式
-    fcntl(fd, F_SETFL, new_flag);
+    m_timer.data = this;
 }
+http_conn::~http_conn() {}
 
-// 添加文件描述符到epoll中
+// 添加文件描述符到epoll中，fd在创建时(socket/accept4)就已经设置为非阻塞模式
 void addfd(int epollfd, int fd, bool one_shot)
 {
     epoll_event event;
@@ -51,9 +57,6 @@ void addfd(int epollfd, int fd, bool one_shot)
     }
     // 将文件描述符添加到epoll队列中
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-
-    // 设置socket为非阻塞模式
-    setnonblocking(fd);
 }
 // 从epoll中删除文件描述符
 void removefd(int epollfd, int fd)
@@ -62,6 +65,26 @@ void removefd(int epollfd, int fd)
     close(fd);
 }
 
+// 文件描述符耗尽(EMFILE/ENFILE)时，accept会一直失败，而连接仍留在监听队列中，
+// 水平触发或者多次触发的accept会因此空转。预留的spare_fd在此时被关闭，腾出一个描述符
+// 接受一个连接后立即关闭，然后重新占住spare_fd，每次丢弃一个等待的连接，
+// 客户端会立即得知连接被关闭，而不是一直等待
+bool shed_connection(int listenfd, int *spare_fd)
+{
+    if (*spare_fd < 0)
+    {
+        return false;
+    }
+    close(*spare_fd);
+    int connfd = accept(listenfd, NULL, NULL);
+    if (connfd >= 0)
+    {
+        close(connfd);
+    }
+    *spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return connfd >= 0;
+}
+
 // 修改文件描述符,重置socket上的EPOLLONESHOT事件，以确保一次可读，EPOLLIN事件被触发
 void modfd(int epollfd, int fd, int ev)
 {
@@ -76,38 +99,64 @@ void modfd(int epollfd, int fd, int ev)
 }
 
 // 初始化连接
-void http_conn::init(int sockfd, const sockaddr_in &addr)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, conn_timers *timers, uring_loop *uring)
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_uring = uring;
+    m_timers = timers;
     // 端口复用
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // 响应已经在用户态合并成一次发送，Nagle算法只会让流水线的后一批响应等待前一批的ACK
+    setsockopt(m_sockfd, IPPROTO_TCP, TCP_NODELAY, &reuse, sizeof(reuse));
 
-    // 将新的连接添加到epoll事件表中
-    addfd(m_epollfd, sockfd, true);
+    // 将新的连接添加到epoll事件表中，io_uring模式下由ring直接提交读写请求
+    if (!m_uring)
+    {
+        addfd(m_epollfd, sockfd, true);
+    }
     // 用户数量加1
     m_user_count++;
+    metrics::count(COUNTER_ACCEPTS);
     init();
+    m_request_started = false;
+
+    // 等待第一个请求按空闲超时计算
+    if (m_timers)
+    {
+        set_deadline(TIMEOUT_IDLE);
+        m_timers->add(&m_timer, deadline());
+    }
 }
 
 void http_conn::init()
+{
+    init_request(0);
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_start = 0;
+    bytes_to_send = 0;
+}
+
+void http_conn::init_request(int start)
 {
     m_check_state = CHECK_STATE_REQUESTLINE; // 初始状态为检查请求行
     m_linger = false;                        // 默认不保持链接  Connection : keep-alive保持连接
 
     m_method = GET; // 默认请求方式为GET
-    m_url = 0;
-    m_version = 0;
+    m_url.off = m_url.len = 0;
+    m_version.off = m_version.len = 0;
     m_content_length = 0;
-    m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, READ_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+    m_header_count = 0;
+    memset(m_known, -1, sizeof(m_known));
+    m_start_line = start;
+    m_checked_idx = start;
+    m_request_end = start;
+    m_line_count = 0;
+    m_line_next = 0;
+    m_scan_idx = start;
 }
 
 // 关闭连接
@@ -115,8 +164,24 @@ void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
-        // 将连接从epoll事件表中删除
-        removefd(m_epollfd, m_sockfd);
+        // 先删除定时器再关闭socket，超时处理不会看到已经关闭的连接
+        if (m_timers)
+        {
+            m_timers->del(&m_timer);
+        }
+        // 响应可能还没有发送完，释放文件映射或者打开的文件
+        unmap();
+        // 归还借用的缓冲区
+        release_buffers();
+        // 将连接从epoll事件表中删除，io_uring模式下连接上已没有未完成的请求，直接关闭即可
+        if (m_uring)
+        {
+            close(m_sockfd);
+        }
+        else
+        {
+            removefd(m_epollfd, m_sockfd);
+        }
         // 关闭连接
         m_sockfd = -1;
         // 用户数量减1
@@ -127,16 +192,26 @@ void http_conn::close_conn(bool real_close)
 // 读取浏览器发来的全部数据
 bool http_conn::read()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    // 连接空闲时没有缓冲区，有数据到达时才借用
+    if (!m_buf && !acquire_buffers())
+    {
+        return false;
+    }
+
+    // 请求太大，读缓冲区已经不能再增长
+    if (m_buf->read.room() == 0)
     {
         return false;
     }
 
     // 读到的字节
     int bytes_read = 0;
-    while (true)
+    int len = 0;
+    char *buf;
+    // 当前块满了就借用一个新的块，缓冲区达到上限时先停下，流水线中的请求处理完之后重新注册读事件时会继续读
+    while ((buf = m_buf->read.prepare(&len)) != NULL)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv(m_sockfd, buf, len, 0);
         if (bytes_read == -1)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -153,20 +228,72 @@ bool http_conn::read()
         }
 
         // 更新读取到的字节数
-        m_read_idx += bytes_read;
+        m_buf->read.commit(bytes_read);
+        request_started();
     }
 
-    std::cout << "一次读完所有的数据：" << m_read_buf << std::endl;
+    LOG_DEBUG("fd %d: %d bytes in read buffer", m_sockfd, m_buf->read.size());
     return true;
 }
 
+// io_uring收到的数据由reactor拷贝进读缓冲区
+bool http_conn::feed(const char *data, int len)
+{
+    if (!m_buf && !acquire_buffers())
+    {
+        return false;
+    }
+    request_started();
+    return m_buf->read.append(data, len);
+}
+
+void http_conn::request_started()
+{
+    // 头部超时从请求的第一个字节开始计算，之后收到数据也不延长
+    if (!m_request_started)
+    {
+        m_request_started = true;
+        set_deadline(TIMEOUT_HEADER);
+        m_buf->request_ns = metrics::now_ns();
+    }
+}
+
+bool http_conn::acquire_buffers()
+{
+    m_buf = m_buffer_pool->get();
+    return m_buf != NULL;
+}
+
+void http_conn::release_buffers()
+{
+    if (m_buf)
+    {
+        m_buf->read.clear();
+        m_buffer_pool->put(m_buf);
+        m_buf = NULL;
+    }
+}
+
+void http_conn::rearm(int ev)
+{
+    if (m_uring)
+    {
+        // 工作线程不能直接操作ring，交给所属的reactor提交
+        m_uring->post(this, ev);
+    }
+    else
+    {
+        modfd(m_epollfd, m_sockfd, ev);
+    }
+}
+
 // 主状态机，解析HTTP请求
 http_conn::HTTP_CODE http_conn::process_read()
 {
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
 
-    char *text = 0;
+    const char *text = 0;
 
     while ((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK) || (line_status = parse_line()) == LINE_OK)
     {
@@ -178,134 +305,589 @@ http_conn::HTTP_CODE http_conn::process_read()
         // 更新行起始位置
         m_start_line = m_checked_idx;
 
-        printf("got 1 http line: %s\n", text);
+        LOG_DEBUG("got 1 http line: %.*s", m_line_len, text);
 
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
-            ret = parse_request_line(text);
+            ret = parse_request_line(text, m_line_len);
             if (ret == BAD_REQUEST)
             {
                 return BAD_REQUEST;
             }
             break;
         case CHECK_STATE_HEADER:
-            ret = parse_headers(text);
+            ret = parse_headers(text, m_line_len);
             if (ret == BAD_REQUEST)
             {
                 return BAD_REQUEST;
             }
             else if (ret == GET_REQUEST)
             {
+                m_request_end = m_checked_idx;
                 return do_request();
             }
             break;
         case CHECK_STATE_CONTENT:
-            ret = parse_content(text);
+            ret = parse_content();
             if (ret == GET_REQUEST)
             {
+                m_request_end = m_checked_idx + m_content_length;
                 return do_request();
             }
-            line_status = LINE_OPEN;
-            break;
+            // 请求体还不完整。请求体不按行扫描，否则没有换行的大请求体会被当成过长的行
+            return NO_REQUEST;
         default:
             return INTERNAL_ERROR;
         }
     }
 
+    // 行有语法错误，或者一行太长
+    if (line_status == LINE_BAD)
+    {
+        return BAD_REQUEST;
+    }
     return NO_REQUEST;
 }
 
 // 解析一行数据,判断依据是\r\n
+// 行的位置来自扫描器建立的索引，索引取完之后再扫描新读入的数据
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    if (m_line_next == m_line_count)
     {
-        // 获取当前要分析的字节
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r')
+        m_line_next = 0;
+        m_line_count = m_buf->read.scan(&m_scan_idx, m_buf->lines, MAX_SCAN_LINES);
+        if (m_line_count <= 0)
         {
-            // \r可能是最后一个字符，所以要判断下一个字符是不是\n
-            if ((m_checked_idx + 1) == m_read_idx)
+            // 0表示没有找到\r\n，需要继续读取数据；-1表示一行超过了read_buffer::MAX_LINE
+            LINE_STATUS status = m_line_count == 0 ? LINE_OPEN : LINE_BAD;
+            m_line_count = 0;
+            return status;
+        }
+    }
+
+    const scan_line &line = m_buf->lines[m_line_next++];
+    // 行中有单独的\r，或者\n前面不是\r。同一行在内存中是连续的
+    if (line.colon == SCAN_BAD_LINE || line.end == m_checked_idx || *m_buf->read.at(line.end - 1) != '\r')
+    {
+        return LINE_BAD;
+    }
+
+    // 行的内容为[m_checked_idx, line.end - 1)，不写入\0，读缓冲区保持原样
+    m_line_start = m_checked_idx;
+    m_line_len = line.end - 1 - m_checked_idx;
+    m_checked_idx = line.end + 1;
+    m_line_colon = line.colon < 0 ? line.colon : line.colon - m_line_start;
+    return LINE_OK;
+}
+
+// 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
+// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
+// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
+http_conn::HTTP_CODE http_conn::do_request()
+{
+    const char *url = span_ptr(m_url);
+    if (m_url.len >= (int)sizeof(METRICS_URL) - 1 && memcmp(url, METRICS_URL, sizeof(METRICS_URL) - 1) == 0)
+    {
+        // 保留的URL，合并各线程的统计生成响应内容
+        bool prometheus = m_url.len == sizeof(METRICS_PROMETHEUS_URL) - 1 &&
+                          memcmp(url, METRICS_PROMETHEUS_URL, m_url.len) == 0;
+        if (!prometheus && m_url.len != sizeof(METRICS_URL) - 1)
+        {
+            return NO_RESOURCE;
+        }
+        m_buf->dynamic_body = metrics::render(prometheus, m_user_count.load(std::memory_order_relaxed));
+        return DYNAMIC_REQUEST;
+    }
+    m_buf->fresh_stat = false;
+    while (true)
+    {
+        HTTP_CODE ret = resolve(url, m_url.len, m_buf->real_file, &m_buf->file_stat, &m_buf->validators);
+        if (ret != FILE_REQUEST)
+        {
+            return ret;
+        }
+        compress_cache::variant *variant = select_encoding(url);
+
+        // 条件请求同样只需要缓存的验证器，304响应不打开也不映射文件
+        if (not_modified())
+        {
+            if (variant)
             {
-                return LINE_OPEN;
+                m_compress_cache->release(variant);
             }
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
+            return NOT_MODIFIED;
+        }
+
+        // 只需要文件大小就能确定Range，无法满足时不必获取文件
+        m_buf->range_count = parse_range(m_buf->file_stat.st_size);
+        if (m_buf->range_count < 0)
+        {
+            if (variant)
             {
-                // \r\n
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
+                m_compress_cache->release(variant);
             }
-            return LINE_BAD;
+            return RANGE_NOT_SATISFIABLE;
+        }
+
+        m_file_offset = 0;
+        if (variant)
+        {
+            // 压缩版本在内存中，和映射的文件一样发送
+            m_buf->files[m_file_count] = NULL;
+            m_buf->variants[m_file_count++] = variant;
+            m_file_address = variant->data;
+            m_file_fd = -1;
+            return FILE_REQUEST;
         }
-        else if (temp == '\n')
+
+        // 从注册表中获取文件的映射，其他连接已经映射过的文件不需要再次打开。
+        // 大文件只打开不映射，直接用sendfile从页缓存发送，省去建立和拆除映射以及缺页的开销
+        file_registry::file *file = m_file_registry->acquire(m_buf->real_file, m_buf->file_stat, m_buf->file_stat.st_size >= m_sendfile_threshold);
+        if (!file)
         {
-            // \n可能是最后一个字符，所以要判断前一个字符是不是\r
-            if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r'))
+            // 打开的文件已经不是stat结果描述的那个(stat之后被改写或截短)，缓存的结果过期了。
+            // 不查缓存重新stat一次，新的结果同时覆盖缓存项
+            if (m_buf->fresh_stat)
             {
-                // \r\n
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
+                return NO_RESOURCE;
             }
-            return LINE_BAD;
+            m_buf->fresh_stat = true;
+            continue;
         }
+        // 流水线中前面的响应可能还引用着别的文件，全部发送完之后一起释放
+        m_buf->files[m_file_count] = file;
+        m_buf->variants[m_file_count++] = NULL;
+        m_file_address = file->addr;
+        m_file_fd = file->fd;
+        return FILE_REQUEST;
     }
-    return LINE_OPEN; // 没有找到\r\n，需要继续读取数据
 }
 
-// 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
-// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
-// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
-http_conn::HTTP_CODE http_conn::do_request()
+http_conn::HTTP_CODE http_conn::resolve(const char *url, int len, char *real_file, struct stat *st, file_validators *v)
 {
-    // 将目标文件的相关信息，比如是否是目录，文件大小等信息读取到m_file_stat结构体中
-    strcpy(m_real_file, doc_root);
+    int verdict;
+    if (m_stat_cache && !m_buf->fresh_stat && m_stat_cache->lookup(url, len, real_file, st, &verdict, v))
+    {
+        // 缓存命中，省去路径拼接和stat
+        metrics::count(COUNTER_STAT_CACHE_HITS);
+        return (HTTP_CODE)verdict;
+    }
+    if (m_stat_cache)
+    {
+        metrics::count(COUNTER_STAT_CACHE_MISSES);
+    }
+    unsigned long generation = m_stat_cache ? m_stat_cache->generation() : 0;
+    HTTP_CODE ret = check_file(url, len, real_file, st);
+    if (ret == FILE_REQUEST)
+    {
+        make_validators(*st, v);
+    }
+    if (m_stat_cache)
+    {
+        m_stat_cache->insert(url, len, real_file, st, ret, ret == FILE_REQUEST, v, generation);
+    }
+    return ret;
+}
+
+http_conn::HTTP_CODE http_conn::check_file(const char *url, int url_len, char *real_file, struct stat *st)
+{
+    // 将目标文件的相关信息，比如是否是目录，文件大小等信息读取到st中
+    strcpy(real_file, doc_root);
     int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if (stat(m_real_file, &m_file_stat) < 0)
+    if (url_len > FILENAME_LEN - len - 1)
+    {
+        return NO_RESOURCE;
+    }
+    memcpy(real_file + len, url, url_len);
+    real_file[len + url_len] = '\0';
+    // 获取real_file文件的相关的状态信息，-1失败，0成功
+    if (stat(real_file, st) < 0)
     {
         return NO_RESOURCE;
     }
 
     // 判断访问权限
-    if (!(m_file_stat.st_mode & S_IROTH))
+    if (!(st->st_mode & S_IROTH))
     {
         return FORBIDDEN_REQUEST;
     }
 
     // 判断是否是目录
-    if (S_ISDIR(m_file_stat.st_mode))
+    if (S_ISDIR(st->st_mode))
     {
         return BAD_REQUEST;
     }
 
-    // 以只读方式打开文件
-    int fd = open(m_real_file, O_RDONLY);
-    // 创建内存映射
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
     return FILE_REQUEST;
 }
 
+// 跳过[p, end)开头的空格和制表符
+static const char *skip_blank(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        ++p;
+    }
+    return p;
+}
+
+// 客户端可以接受的内容编码
+enum
+{
+    ENCODING_GZIP = 1,
+    ENCODING_BR = 2,
+};
+
+// Accept-Encoding: gzip, deflate, br;q=0.5, *;q=0。只区分q是否为0，不按q值排序，
+// 压缩格式的优先顺序由服务器决定。返回ENCODING_*的组合
+static int accepted_encodings(const char *p, int len)
+{
+    const char *end = p + len;
+    int accepted = 0, rejected = 0, any = 0;
+    while (p < end)
+    {
+        const char *item_end = (const char *)memchr(p, ',', end - p);
+        if (!item_end)
+        {
+            item_end = end;
+        }
+        const char *name = skip_blank(p, item_end);
+        const char *name_end = name;
+        while (name_end < item_end && *name_end != ';' && *name_end != ' ' && *name_end != '\t')
+        {
+            ++name_end;
+        }
+        int name_len = name_end - name;
+
+        // 参数中只关心q，q=0、q=0.0等表示明确拒绝
+        bool zero = false;
+        const char *semi = (const char *)memchr(name_end, ';', item_end - name_end);
+        if (semi)
+        {
+            const char *q = skip_blank(semi + 1, item_end);
+            if (item_end - q >= 3 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=' && q[2] == '0')
+            {
+                zero = true;
+                for (q += 3; q < item_end && *q != ' ' && *q != '\t' && *q != ';'; ++q)
+                {
+                    zero = zero && (*q == '.' || *q == '0');
+                }
+            }
+        }
+
+        int flag = 0;
+        if ((name_len == 4 && strncasecmp(name, "gzip", 4) == 0) || (name_len == 6 && strncasecmp(name, "x-gzip", 6) == 0))
+        {
+            flag = ENCODING_GZIP;
+        }
+        else if (name_len == 2 && strncasecmp(name, "br", 2) == 0)
+        {
+            flag = ENCODING_BR;
+        }
+        else if (name_len == 1 && *name == '*')
+        {
+            any = zero ? 0 : ENCODING_GZIP | ENCODING_BR;
+        }
+        if (zero)
+        {
+            rejected |= flag;
+        }
+        else
+        {
+            accepted |= flag;
+        }
+        p = item_end + 1;
+    }
+    // *只代表没有单独列出的编码
+    return accepted | (any & ~rejected);
+}
+
+// 预先压缩好的文件的后缀，按优先顺序排列
+static const struct
+{
+    int flag;
+    const char *suffix;
+    const char *encoding;
+} precompressed[] = {
+    {ENCODING_BR, ".br", "br"},
+    {ENCODING_GZIP, ".gz", "gzip"},
+};
+
+// 先找预先压缩好的同名文件foo.html.br、foo.html.gz(它们和普通文件一样经过stat缓存)，
+// 找到时把m_buf中的路径、stat结果和验证器换成它的；没有时再查压缩缓存中的gzip版本，
+// 还没有压缩好的文件由后台线程压缩，这次发送未压缩的内容。
+// Range请求总是针对未压缩的内容，续传时的字节偏移与文件一致
+compress_cache::variant *http_conn::select_encoding(const char *url)
+{
+    const mime_type &mime = lookup_mime(url, m_url.len);
+    m_buf->content_type = mime.type;
+    m_buf->content_encoding = NULL;
+    m_buf->vary = mime.compressible;
+
+    const char *value, *range;
+    int len, range_len;
+    if (!mime.compressible || !get_header(HEADER_ACCEPT_ENCODING, &value, &len) ||
+        get_header(HEADER_RANGE, &range, &range_len))
+    {
+        return NULL;
+    }
+    int accepted = accepted_encodings(value, len);
+
+    char sibling_url[FILENAME_LEN];
+    char sibling_file[FILENAME_LEN];
+    struct stat st;
+    file_validators v;
+    for (size_t i = 0; i < sizeof(precompressed) / sizeof(precompressed[0]) && m_url.len + 3 < FILENAME_LEN; ++i)
+    {
+        if (!(accepted & precompressed[i].flag))
+        {
+            continue;
+        }
+        memcpy(sibling_url, url, m_url.len);
+        memcpy(sibling_url + m_url.len, precompressed[i].suffix, 3);
+        if (resolve(sibling_url, m_url.len + 3, sibling_file, &st, &v) == FILE_REQUEST)
+        {
+            strcpy(m_buf->real_file, sibling_file);
+            m_buf->file_stat = st;
+            m_buf->validators = v;
+            m_buf->content_encoding = precompressed[i].encoding;
+            metrics::count(COUNTER_COMPRESSED);
+            return NULL;
+        }
+    }
+
+    if (!(accepted & ENCODING_GZIP) || !m_compress_cache)
+    {
+        return NULL;
+    }
+    compress_cache::variant *variant = m_compress_cache->acquire(m_buf->real_file, m_buf->file_stat);
+    if (!variant)
+    {
+        metrics::count(COUNTER_COMPRESS_MISSES);
+        return NULL;
+    }
+    // 之后的条件请求、Range和响应头都针对压缩版本
+    m_buf->file_stat.st_size = variant->size;
+    m_buf->validators = variant->validators;
+    m_buf->content_encoding = "gzip";
+    metrics::count(COUNTER_COMPRESSED);
+    return variant;
+}
+
+// If-None-Match: "a", W/"b"，或者*。按弱比较，忽略W/前缀
+static bool etag_matches(const char *p, int len, const char *etag, int etag_len)
+{
+    const char *end = p + len;
+    while (p < end)
+    {
+        p = skip_blank(p, end);
+        if (p < end && *p == ',')
+        {
+            ++p;
+            continue;
+        }
+        if (p == end)
+        {
+            break;
+        }
+        if (*p == '*')
+        {
+            return true;
+        }
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+        {
+            p += 2;
+        }
+        const char *close = p < end && *p == '"' ? (const char *)memchr(p + 1, '"', end - p - 1) : NULL;
+        if (!close)
+        {
+            return false;
+        }
+        if (close + 1 - p == etag_len && memcmp(p, etag, etag_len) == 0)
+        {
+            return true;
+        }
+        p = close + 1;
+    }
+    return false;
+}
+
+// 有If-None-Match时只看它，If-Modified-Since被忽略；日期无法解析时当作没有这个字段
+bool http_conn::not_modified() const
+{
+    const char *p;
+    int len;
+    const file_validators &v = m_buf->validators;
+    if (get_header(HEADER_IF_NONE_MATCH, &p, &len))
+    {
+        return etag_matches(p, len, v.headers + v.etag_off, v.etag_len);
+    }
+    time_t since;
+    if (get_header(HEADER_IF_MODIFIED_SINCE, &p, &len) && parse_http_date(p, len, &since))
+    {
+        return m_buf->file_stat.st_mtime <= since;
+    }
+    return false;
+}
+
+// 解析Range中的一个十进制偏移量，返回数字之后的位置，没有数字时返回NULL。
+// 数字过大时停在一个足够大的值，不会溢出，这样的偏移量总是超出文件大小
+static const char *parse_offset(const char *p, const char *end, off_t *value)
+{
+    const off_t limit = (off_t)1 << 56;
+    const char *start = p;
+    off_t v = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+        if (v < limit)
+        {
+            v = v * 10 + (*p - '0');
+        }
+    }
+    *value = v;
+    return p == start ? NULL : p;
+}
+
+// Range: bytes=0-499, 1000-, -500
+// 语法错误、单位不是bytes或者片段太多时忽略Range，发送整个文件，这是协议允许的
+int http_conn::parse_range(off_t size)
+{
+    const char *p;
+    int len;
+    if (!get_header(HEADER_RANGE, &p, &len))
+    {
+        return 0;
+    }
+
+    // If-Range中的ETag或日期与文件当前的不同，说明客户端已有的部分已经过期，发送整个文件。
+    // ETag要求强比较，弱ETag(W/"...")总是不匹配
+    const char *validator;
+    int validator_len;
+    if (get_header(HEADER_IF_RANGE, &validator, &validator_len))
+    {
+        const file_validators &v = m_buf->validators;
+        bool etag = validator_len > 0 && validator[0] == '"';
+        int off = etag ? v.etag_off : v.date_off;
+        int expect_len = etag ? v.etag_len : v.date_len;
+        if (validator_len != expect_len || memcmp(validator, v.headers + off, expect_len) != 0)
+        {
+            return 0;
+        }
+    }
+
+    const char *end = p + len;
+    if (len < 6 || strncasecmp(p, "bytes=", 6) != 0)
+    {
+        return 0;
+    }
+    p += 6;
+
+    int count = 0;
+    bool parsed = false; // 至少有一个语法正确的片段
+    while (p < end)
+    {
+        p = skip_blank(p, end);
+        if (p < end && *p == ',')
+        {
+            // 列表中允许空的元素
+            ++p;
+            continue;
+        }
+
+        byte_range r;
+        bool satisfiable;
+        off_t first, last;
+        if (p < end && *p == '-')
+        {
+            // 后缀形式：最后last个字节，超过文件大小时就是整个文件
+            p = parse_offset(p + 1, end, &last);
+            if (!p)
+            {
+                return 0;
+            }
+            satisfiable = last > 0 && size > 0;
+            r.first = last >= size ? 0 : size - last;
+            r.len = size - r.first;
+        }
+        else
+        {
+            p = parse_offset(p, end, &first);
+            if (!p || p == end || *p != '-')
+            {
+                return 0;
+            }
+            const char *next = parse_offset(p + 1, end, &last);
+            if (!next)
+            {
+                // first-，到文件末尾
+                p = p + 1;
+                last = size - 1;
+            }
+            else if (last < first)
+            {
+                return 0;
+            }
+            else
+            {
+                p = next;
+            }
+            // 起始位置超出文件的片段无法满足，结束位置超出文件时截断
+            satisfiable = first < size;
+            r.first = first;
+            r.len = (last < size ? last : size - 1) - first + 1;
+        }
+
+        p = skip_blank(p, end);
+        if (p < end && *p != ',')
+        {
+            return 0;
+        }
+        parsed = true;
+        if (satisfiable)
+        {
+            if (count == MAX_RANGES)
+            {
+                return 0;
+            }
+            m_buf->ranges[count++] = r;
+        }
+    }
+
+    if (!parsed)
+    {
+        return 0;
+    }
+    return count > 0 ? count : -1;
+}
+
+// 在[p, end)中查找空格或制表符，没有时返回NULL
+static const char *find_blank(const char *p, const char *end)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == ' ' || *p == '\t')
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
 // 解析HTTP请求行
-http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
+http_conn::HTTP_CODE http_conn::parse_request_line(const char *text, int len)
 {
     // GET /index.html HTTP/1.1
+    const char *end = text + len;
+
     // 解析请求方法
-    m_url = strpbrk(text, " \t");
-    if (!m_url)
+    const char *url = find_blank(text, end);
+    if (!url)
     {
         return BAD_REQUEST;
     }
-    *m_url++ = '\0';
-
-    // 解析请求URL
-    char *method = text;
-    if (strcasecmp(method, "GET") == 0)
+    if (url - text == 3 && strncasecmp(text, "GET", 3) == 0)
     {
         m_method = GET;
     }
@@ -313,32 +895,36 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     {
         return BAD_REQUEST;
     }
+    ++url;
 
     // 解析HTTP版本号
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version)
+    const char *version = find_blank(url, end);
+    if (!version)
     {
         return BAD_REQUEST;
     }
-    *m_version++ = '\0';
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    const char *url_end = version++;
+    // HTTP/1.0和HTTP/1.1的请求都接受，响应一律使用HTTP/1.1；两者都只在请求带有Connection: keep-alive时保持连接
+    if (end - version != 8 || (strncasecmp(version, "HTTP/1.1", 8) != 0 && strncasecmp(version, "HTTP/1.0", 8) != 0))
     {
         return BAD_REQUEST;
     }
+    m_version.off = m_line_start + (version - text);
+    m_version.len = 8;
 
     // 解析请求URL
-    if (strncasecmp(m_url, "http://", 7) == 0)
+    if (url_end - url >= 7 && strncasecmp(url, "http://", 7) == 0)
     {
-        // 跳过http://
-        m_url += 7;
-        // 查找URL中的"/"
-        m_url = strchr(m_url, '/');
+        // 跳过http://，查找URL中的"/"
+        url = (const char *)memchr(url + 7, '/', url_end - url - 7);
     }
 
-    if (!m_url || m_url[0] != '/')
+    if (!url || url == url_end || url[0] != '/')
     {
         return BAD_REQUEST;
     }
+    m_url.off = m_line_start + (url - text);
+    m_url.len = url_end - url;
 
     // HTTP请求行处理完毕，状态转移到头部字段的分析
     m_check_state = CHECK_STATE_HEADER;
@@ -347,10 +933,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 }
 
 // 解析HTTP请求的一个头部信息
-http_conn::HTTP_CODE http_conn::parse_headers(char *text)
+http_conn::HTTP_CODE http_conn::parse_headers(const char *text, int len)
 {
     // 遇到空行，表示头部字段解析完毕
-    if (text[0] == '\0')
+    if (len == 0)
     {
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
         // 状态机转移到CHECK_STATE_CONTENT状态
@@ -362,240 +948,662 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         // 否则说明我们已经得到了一个完整的HTTP请求
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+
+    // 没有冒号的行不是头部字段，忽略
+    if (m_line_colon == SCAN_NO_COLON)
+    {
+        return NO_REQUEST;
+    }
+
+    // 字段值去掉首尾的空白
+    const char *name = text;
+    int name_len = m_line_colon;
+    const char *value = text + m_line_colon + 1;
+    const char *end = text + len;
+    while (value < end && (*value == ' ' || *value == '\t'))
+    {
+        ++value;
+    }
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+        --end;
+    }
+    int value_len = end - value;
+
+    // 已知字段通过完美哈希O(1)找到，总能被记录；其余字段在还有空位时记录
+    header_id id = lookup_header(name, name_len);
+    bool known = id != HEADER_UNKNOWN && m_known[id] == -1;
+    if (known || m_header_count < MAX_HEADERS - HEADER_COUNT)
+    {
+        header_entry &h = m_buf->headers[m_header_count];
+        h.name.off = m_line_start;
+        h.name.len = name_len;
+        h.value.off = m_line_start + (value - text);
+        h.value.len = value_len;
+        if (known)
+        {
+            m_known[id] = m_header_count;
+        }
+        ++m_header_count;
+    }
+
+    switch (id)
     {
+    case HEADER_CONNECTION:
         // 处理Connection 头部字段  Connection: keep-alive
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+        if (value_len == 10 && strncasecmp(value, "keep-alive", 10) == 0)
         {
             m_linger = true;
         }
+        break;
+    case HEADER_CONTENT_LENGTH:
+        // 处理Content-Length头部字段。只接受纯数字，请求体必须能完整放进读缓冲区，
+        // 否则请求的结束位置无法确定，按语法错误处理并关闭连接
+        if (value_len == 0)
+        {
+            return BAD_REQUEST;
+        }
+        m_content_length = 0;
+        for (const char *p = value; p < end; ++p)
+        {
+            if (*p < '0' || *p > '9')
+            {
+                return BAD_REQUEST;
+            }
+            m_content_length = m_content_length * 10 + (*p - '0');
+            if (m_content_length > read_buffer::MAX_SIZE)
+            {
+                return BAD_REQUEST;
+            }
+        }
+        break;
+    default:
+        break;
     }
-    else if (strncasecmp(text, "Content-Length:", 15) == 0)
+    return NO_REQUEST;
+}
+
+bool http_conn::get_header(header_id id, const char **value, int *len) const
+{
+    if (id < 0 || id >= HEADER_COUNT || m_known[id] == -1)
     {
-        // 处理Content-Length头部字段
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        return false;
     }
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    const header_entry &h = m_buf->headers[m_known[id]];
+    *value = span_ptr(h.value);
+    *len = h.value.len;
+    return true;
+}
+
+bool http_conn::get_header(const char *name, const char **value, int *len) const
+{
+    int name_len = strlen(name);
+    header_id id = lookup_header(name, name_len);
+    if (id != HEADER_UNKNOWN)
     {
-        // 处理Host头部字段
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        return get_header(id, value, len);
     }
-    else
+    for (int i = 0; i < m_header_count; ++i)
     {
-        printf("oop! unknow header %s\n", text);
+        const header_entry &h = m_buf->headers[i];
+        if (h.name.len == name_len && strncasecmp(span_ptr(h.name), name, name_len) == 0)
+        {
+            *value = span_ptr(h.value);
+            *len = h.value.len;
+            return true;
+        }
     }
-    return NO_REQUEST;
+    return false;
+}
+
+void http_conn::header_at(int i, const char **name, int *name_len, const char **value, int *value_len) const
+{
+    const header_entry &h = m_buf->headers[i];
+    *name = span_ptr(h.name);
+    *name_len = h.name.len;
+    *value = span_ptr(h.value);
+    *value_len = h.value.len;
 }
 
 // 我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
-http_conn::HTTP_CODE http_conn::parse_content(char *text)
+http_conn::HTTP_CODE http_conn::parse_content()
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    if (m_buf->read.size() >= (m_content_length + m_checked_idx))
     {
-        text[m_content_length] = '\0';
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 
 
-// 对内存映射区执行munmap操作
+// 将目标文件交还给注册表，由注册表决定何时munmap
 void http_conn::unmap() {
-    if( m_file_address )
+    for( int i = 0; i < m_file_count; ++i )
+    {
+        if( m_buf->files[i] )
+        {
+            m_file_registry->release( m_buf->files[i] );
+        }
+        else
+        {
+            m_compress_cache->release( m_buf->variants[i] );
+        }
+    }
+    if( m_buf )
     {
-        munmap( m_file_address, m_file_stat.st_size );
-        m_file_address = 0;
+        m_buf->dynamic_body.clear();
     }
+    m_file_count = 0;
+    m_file_address = 0;
+    m_file_fd = -1;
 }
 
 // 写HTTP响应
 bool http_conn::write()
 {
-    int temp = 0;
-    
     if ( bytes_to_send == 0 ) {
         // 将要发送的字节为0，这一次响应结束。
-        modfd( m_epollfd, m_sockfd, EPOLLIN ); 
-        init();
+        if( !finish_response() ) {
+            return false;
+        }
+        if( !pipelined() ) {
+            rearm( EPOLLIN );
+        }
         return true;
     }
 
-    while(1) {
-        // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+    // 先发送iovec中的数据(合并的所有响应头，以及mmap的文件内容)
+    while( m_iv_start < m_iv_count ) {
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = m_buf->iv + m_iv_start;
+        msg.msg_iovlen = m_iv_count - m_iv_start;
+        // 最后一个响应用sendfile发送时，MSG_MORE让响应头和随后的文件内容合并到同一个报文段中
+        int temp = sendmsg( m_sockfd, &msg, use_sendfile() ? MSG_MORE : 0 );
         if ( temp <= -1 ) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ) {
-                modfd( m_epollfd, m_sockfd, EPOLLOUT );
+                // 每次可写都说明对方在接收，发送超时从现在重新计算
+                set_deadline( TIMEOUT_WRITE );
+                rearm( EPOLLOUT );
                 return true;
             }
             unmap();
             return false;
         }
+        sent( temp );
+    }
 
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
+    if( use_sendfile() ) {
+        if( !send_file() ) {
+            unmap();
+            return false;
+        }
+        if( bytes_to_send > 0 ) {
+            // socket发送缓冲区满了，等待下一轮EPOLLOUT事件
+            set_deadline( TIMEOUT_WRITE );
+            rearm( EPOLLOUT );
+            return true;
+        }
+    }
+
+    // 没有数据要发送了。读缓冲区中还有流水线请求时不注册读事件，由调用者交给线程池
+    if( !finish_response() ) {
+        return false;
+    }
+    if( !pipelined() ) {
+        rearm( EPOLLIN );
+    }
+    return true;
+}
+
+void http_conn::sent(int bytes)
+{
+    bytes_to_send -= bytes;
+    metrics::count(COUNTER_BYTES_SENT, bytes);
+
+    // 跳过已经发完的iovec，调整发了一部分的iovec
+    while( m_iv_start < m_iv_count && bytes >= (int)m_buf->iv[m_iv_start].iov_len )
+    {
+        bytes -= m_buf->iv[m_iv_start].iov_len;
+        m_buf->iv[m_iv_start].iov_len = 0;
+        ++m_iv_start;
+    }
+    if( bytes > 0 )
+    {
+        m_buf->iv[m_iv_start].iov_base = (char *)m_buf->iv[m_iv_start].iov_base + bytes;
+        m_buf->iv[m_iv_start].iov_len -= bytes;
+    }
+}
 
-        if (bytes_have_send >= m_iv[0].iov_len)
+void http_conn::add_iov(char *base, int len)
+{
+    if (len <= 0)
+    {
+        return;
+    }
+    if (m_iv_count > 0 && (char *)m_buf->iv[m_iv_count - 1].iov_base + m_buf->iv[m_iv_count - 1].iov_len == base)
+    {
+        m_buf->iv[m_iv_count - 1].iov_len += len;
+        return;
+    }
+    m_buf->iv[m_iv_count].iov_base = base;
+    m_buf->iv[m_iv_count].iov_len = len;
+    ++m_iv_count;
+}
+
+bool http_conn::send_file()
+{
+    while (bytes_to_send > 0)
+    {
+        // 多段响应在片段之间还有分隔行，先把iovec中的分隔行发出去，MSG_MORE让它和随后的片段合并
+        while (m_iv_start < m_iv_count)
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_buf->iv + m_iv_start;
+            msg.msg_iovlen = m_iv_count - m_iv_start;
+            int temp = sendmsg(m_sockfd, &msg, MSG_MORE);
+            if (temp < 0)
+            {
+                return errno == EAGAIN;
+            }
+            sent(temp);
         }
-        else
+        if (bytes_to_send == 0)
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+            break;
         }
 
-        if (bytes_to_send <= 0)
+        if (m_file_offset == m_buf->file_end)
         {
-            // 没有数据要发送了
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger)
+            // 当前片段发完了，接着是下一个片段的分隔行，最后是结束的分隔行
+            int i = m_buf->range_next++;
+            if (m_buf->range_count < 2 || i > m_buf->range_count)
             {
-                init();
-                return true;
+                // 待发送的字节数与片段不符
+                return false;
             }
-            else
+            std::string &body = m_buf->dynamic_body;
+            int end = i < m_buf->range_count ? m_buf->part_off[i + 1] : body.size();
+            m_iv_start = m_iv_count = 0;
+            add_iov(&body[m_buf->part_off[i]], end - m_buf->part_off[i]);
+            if (i < m_buf->range_count)
             {
-                return false;
+                m_file_offset = m_buf->ranges[i].first;
+                m_buf->file_end = m_file_offset + m_buf->ranges[i].len;
             }
+            continue;
         }
 
+        ssize_t temp = sendfile(m_sockfd, m_file_fd, &m_file_offset, m_buf->file_end - m_file_offset);
+        if (temp < 0)
+        {
+            return errno == EAGAIN;
+        }
+        if (temp == 0)
+        {
+            // 文件在发送过程中被截断了
+            return false;
+        }
+        bytes_to_send -= temp;
+        metrics::count(COUNTER_BYTES_SENT, temp);
     }
-
-    
+    return true;
 }
 
-// 往写缓冲中写入待发送的数据
-bool http_conn::add_response( const char* format, ... ) {
-    if( m_write_idx >= WRITE_BUFFER_SIZE ) {
+bool http_conn::finish_response()
+{
+    unmap();
+    // 流水线中的一批响应只记录一次，从这一批中第一个请求开始接收算起
+    metrics::record(HIST_TTLB, metrics::now_ns() - m_buf->request_ns);
+    if (!m_linger)
+    {
         return false;
     }
-    va_list arg_list;
-    va_start( arg_list, format );
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) ) {
+
+    // 请求的结束位置必须落在已读入的数据之内，否则关闭连接，不能让缓冲区倒退。
+    // 流水线中下一个不完整的请求可能已经解析了几行，这里不能和m_checked_idx比较
+    if (m_request_end < 0 || m_request_end > m_buf->read.size())
+    {
         return false;
     }
-    m_write_idx += len;
-    va_end( arg_list );
-    return true;
-}
-
-bool http_conn::add_status_line( int status, const char* title ) {
-    return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
-}
 
-bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+    // 丢掉已经处理的请求，流水线中还没有处理的请求数据从偏移量0开始；
+    // 剩下的数据不多时搬回内嵌的块，借用的块还给slab池
+    m_buf->read.consume(m_request_end);
+    init();
+    // 没有流水线请求，连接进入空闲状态，缓冲区还给池
+    m_request_started = false;
+    if (m_buf->read.size() == 0)
+    {
+        release_buffers();
+        set_deadline(TIMEOUT_IDLE);
+    }
+    else
+    {
+        request_started();
+    }
     return true;
 }
 
-bool http_conn::add_content_length(int content_len) {
-    return add_response( "Content-Length: %d\r\n", content_len );
-}
-
-bool http_conn::add_linger()
-{
-    return add_response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
-}
-
-bool http_conn::add_blank_line()
-{
-    return add_response( "%s", "\r\n" );
-}
-
-bool http_conn::add_content( const char* content )
-{
-    return add_response( "%s", content );
+// "Content-Range: bytes first-last/size\r\n"的最大长度
+static const int CONTENT_RANGE_MAX = 32 + 3 * UINT_DIGITS_MAX;
+
+// 生成Content-Range头部，r为NULL时是416响应使用的"bytes */size"，返回长度
+static int format_content_range( char* buf, const http_conn::byte_range* r, off_t size ) {
+    static const char prefix[] = "Content-Range: bytes ";
+    char* p = buf;
+    memcpy( p, prefix, sizeof( prefix ) - 1 );
+    p += sizeof( prefix ) - 1;
+    if ( r ) {
+        p += format_uint( p, r->first );
+        *p++ = '-';
+        p += format_uint( p, r->first + r->len - 1 );
+    } else {
+        *p++ = '*';
+    }
+    *p++ = '/';
+    p += format_uint( p, size );
+    *p++ = '\r';
+    *p++ = '\n';
+    return p - buf;
 }
 
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+// 生成响应头：拷贝预先生成的部分，再写入Content-Length的数字、Content-Type、Connection、其他字段和当前的Date。
+// content_len小于0表示预先生成的部分已经包含Content-Length(错误响应)；content_type为NULL时是text/html
+bool http_conn::add_headers( const canned_response& r, long content_len, const char* content_type,
+                             const char* extra, int extra_len ) {
+    int type_len = content_type ? strlen( content_type ) : 0;
+    int max_len = r.head_len + MAX_DYNAMIC_HEADERS + type_len + extra_len;
+    if ( m_write_idx + max_len > WRITE_BUFFER_SIZE ) {
+        return false;
+    }
+    char* p = m_buf->write_buf + m_write_idx;
+    memcpy( p, r.head, r.head_len );
+    p += r.head_len;
+    if ( content_len >= 0 ) {
+        memcpy( p, CONTENT_LENGTH_PREFIX, sizeof( CONTENT_LENGTH_PREFIX ) - 1 );
+        p += sizeof( CONTENT_LENGTH_PREFIX ) - 1;
+        p += format_uint( p, content_len );
+        if ( content_type ) {
+            memcpy( p, CONTENT_TYPE_PREFIX, sizeof( CONTENT_TYPE_PREFIX ) - 1 );
+            p += sizeof( CONTENT_TYPE_PREFIX ) - 1;
+            memcpy( p, content_type, type_len );
+            p += type_len;
+            *p++ = '\r';
+            *p++ = '\n';
+        } else {
+            memcpy( p, CONTENT_TYPE_HTML, sizeof( CONTENT_TYPE_HTML ) - 1 );
+            p += sizeof( CONTENT_TYPE_HTML ) - 1;
+        }
+    }
+    if ( m_linger ) {
+        memcpy( p, CONNECTION_KEEP_ALIVE, sizeof( CONNECTION_KEEP_ALIVE ) - 1 );
+        p += sizeof( CONNECTION_KEEP_ALIVE ) - 1;
+    } else {
+        memcpy( p, CONNECTION_CLOSE, sizeof( CONNECTION_CLOSE ) - 1 );
+        p += sizeof( CONNECTION_CLOSE ) - 1;
+    }
+    memcpy( p, extra, extra_len );
+    p += extra_len;
+    memcpy( p, date_header(), DATE_HEADER_LEN );
+    p += DATE_HEADER_LEN;
+    *p++ = '\r';
+    *p++ = '\n';
+    m_write_idx = p - m_buf->write_buf;
+    return true;
 }
 
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
+// 响应追加在已经生成的响应之后，流水线中的多个响应一起发送
 bool http_conn::process_write(HTTP_CODE ret) {
+    int start = m_write_idx;
+    response_id id;
     switch (ret)
     {
         case INTERNAL_ERROR:
-            add_status_line( 500, error_500_title );
-            add_headers( strlen( error_500_form ) );
-            if ( ! add_content( error_500_form ) ) {
-                return false;
-            }
+            id = RESPONSE_500;
             break;
         case BAD_REQUEST:
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if ( ! add_content( error_400_form ) ) {
-                return false;
-            }
+            // 请求有语法错误时无法确定下一个请求从哪里开始，响应之后关闭连接
+            m_linger = false;
+            id = RESPONSE_400;
             break;
         case NO_RESOURCE:
-            add_status_line( 404, error_404_title );
-            add_headers( strlen( error_404_form ) );
-            if ( ! add_content( error_404_form ) ) {
-                return false;
-            }
+            id = RESPONSE_404;
             break;
         case FORBIDDEN_REQUEST:
-            add_status_line( 403, error_403_title );
-            add_headers(strlen( error_403_form));
-            if ( ! add_content( error_403_form ) ) {
-                return false;
-            }
+            id = RESPONSE_403;
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            id = RESPONSE_416;
             break;
         case FILE_REQUEST:
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-
+            if ( m_buf->range_count > 0 ) {
+                return add_ranges( start );
+            }
+        {
+            char extra[sizeof( ACCEPT_RANGES ) + FILE_HEADERS_MAX];
+            memcpy( extra, ACCEPT_RANGES, sizeof( ACCEPT_RANGES ) - 1 );
+            int extra_len = sizeof( ACCEPT_RANGES ) - 1 + format_file_headers( extra + sizeof( ACCEPT_RANGES ) - 1, false );
+            if ( ! add_headers( canned( RESPONSE_200 ), m_buf->file_stat.st_size, m_buf->content_type, extra,
+                                extra_len ) ) {
+                return false;
+            }
+            add_iov( m_buf->write_buf + start, m_write_idx - start );
+            // sendfile模式下iov中只有响应头，文件内容由send_file()发送
+            if ( m_file_fd == -1 ) {
+                add_iov( m_file_address, m_buf->file_stat.st_size );
+            }
+            m_file_offset = 0;
+            m_buf->file_end = m_buf->file_stat.st_size;
+            bytes_to_send += m_write_idx - start + m_buf->file_stat.st_size;
+            metrics::count( COUNTER_REQUESTS );
+            metrics::count( COUNTER_STATUS_200 );
+            return true;
+        }
+        case NOT_MODIFIED:
+        {
+            // 只有响应头，带上验证器供客户端更新缓存
+            char extra[FILE_HEADERS_MAX];
+            if ( ! add_headers( canned( RESPONSE_304 ), -1, NULL, extra, format_file_headers( extra, true ) ) ) {
+                return false;
+            }
+            add_iov( m_buf->write_buf + start, m_write_idx - start );
+            bytes_to_send += m_write_idx - start;
+            metrics::count( COUNTER_REQUESTS );
+            metrics::count( COUNTER_STATUS_304 );
+            return true;
+        }
+        case DYNAMIC_REQUEST:
+        {
+            std::string& body = m_buf->dynamic_body;
+            if ( ! add_headers( canned( RESPONSE_200 ), body.size(), "text/plain; version=0.0.4; charset=utf-8" ) ) {
+                return false;
+            }
+            add_iov( m_buf->write_buf + start, m_write_idx - start );
+            add_iov( &body[0], body.size() );
+            bytes_to_send += m_write_idx - start + body.size();
+            metrics::count( COUNTER_REQUESTS );
+            metrics::count( COUNTER_STATUS_200 );
             return true;
+        }
         default:
             return false;
     }
 
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    // 错误响应的内容不拷贝，直接指向预先生成的静态字符串，416还要告诉客户端文件的大小
+    const canned_response& r = canned( id );
+    char extra[CONTENT_RANGE_MAX];
+    int extra_len = id == RESPONSE_416 ? format_content_range( extra, NULL, m_buf->file_stat.st_size ) : 0;
+    if ( ! add_headers( r, -1, NULL, extra, extra_len ) ) {
+        return false;
+    }
+    add_iov( m_buf->write_buf + start, m_write_idx - start );
+    add_iov( const_cast<char*>( r.body ), r.body_len );
+    bytes_to_send += m_write_idx - start + r.body_len;
+    metrics::count( COUNTER_REQUESTS );
+    metrics::count( ( metric_counter )( COUNTER_STATUS_200 + id ) );
+    return true;
+}
+
+int http_conn::format_file_headers( char* buf, bool not_modified ) const {
+    const file_validators& v = m_buf->validators;
+    char* p = buf;
+    memcpy( p, v.headers, v.headers_len );
+    p += v.headers_len;
+    // 304只带验证器和Vary，不描述内容本身
+    if ( m_buf->content_encoding && ! not_modified ) {
+        memcpy( p, CONTENT_ENCODING_PREFIX, sizeof( CONTENT_ENCODING_PREFIX ) - 1 );
+        p += sizeof( CONTENT_ENCODING_PREFIX ) - 1;
+        int len = strlen( m_buf->content_encoding );
+        memcpy( p, m_buf->content_encoding, len );
+        p += len;
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    if ( m_buf->vary ) {
+        memcpy( p, VARY_ACCEPT_ENCODING, sizeof( VARY_ACCEPT_ENCODING ) - 1 );
+        p += sizeof( VARY_ACCEPT_ENCODING ) - 1;
+    }
+    return p - buf;
+}
+
+bool http_conn::add_ranges( int start ) {
+    off_t size = m_buf->file_stat.st_size;
+    int count = m_buf->range_count;
+    const byte_range* ranges = m_buf->ranges;
+    char extra[CONTENT_RANGE_MAX + FILE_HEADERS_MAX];
+    off_t content_len;
+
+    if ( count == 1 ) {
+        // 单个片段：和完整的响应一样，只是文件内容从片段的起点开始
+        content_len = ranges[0].len;
+        int extra_len = format_content_range( extra, &ranges[0], size );
+        extra_len += format_file_headers( extra + extra_len, false );
+        if ( ! add_headers( canned( RESPONSE_206 ), content_len, m_buf->content_type, extra, extra_len ) ) {
+            return false;
+        }
+        add_iov( m_buf->write_buf + start, m_write_idx - start );
+        if ( m_file_fd == -1 ) {
+            add_iov( m_file_address + ranges[0].first, content_len );
+        }
+    } else {
+        // 多个片段：先生成全部分隔行，dynamic_body不再改变之后才能把其中的位置放进iovec。
+        // 每个响应使用不同的分隔符
+        static thread_local unsigned long seed = metrics::now_ns();
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        char boundary[17];
+        snprintf( boundary, sizeof( boundary ), "%016lx", seed );
+
+        std::string& body = m_buf->dynamic_body;
+        content_len = 0;
+        for ( int i = 0; i < count; ++i ) {
+            m_buf->part_off[i] = body.size();
+            body += "\r\n--";
+            body += boundary;
+            body += "\r\nContent-Type: ";
+            body += m_buf->content_type;
+            body += "\r\n";
+            body.append( extra, format_content_range( extra, &ranges[i], size ) );
+            body += "\r\n";
+            content_len += ranges[i].len;
+        }
+        m_buf->part_off[count] = body.size();
+        body += "\r\n--";
+        body += boundary;
+        body += "--\r\n";
+        content_len += body.size();
+
+        char type[64];
+        snprintf( type, sizeof( type ), "multipart/byteranges; boundary=%s", boundary );
+        if ( ! add_headers( canned( RESPONSE_206 ), content_len, type, extra, format_file_headers( extra, false ) ) ) {
+            return false;
+        }
+        add_iov( m_buf->write_buf + start, m_write_idx - start );
+        if ( m_file_fd == -1 ) {
+            for ( int i = 0; i < count; ++i ) {
+                add_iov( &body[m_buf->part_off[i]], m_buf->part_off[i + 1] - m_buf->part_off[i] );
+                add_iov( m_file_address + ranges[i].first, ranges[i].len );
+            }
+            add_iov( &body[m_buf->part_off[count]], body.size() - m_buf->part_off[count] );
+        } else {
+            // iovec中只放第一个分隔行，之后由send_file()交替发送片段和分隔行
+            add_iov( &body[m_buf->part_off[0]], m_buf->part_off[1] - m_buf->part_off[0] );
+            m_buf->range_next = 1;
+        }
+    }
+    m_file_offset = ranges[0].first;
+    m_buf->file_end = ranges[0].first + ranges[0].len;
+    bytes_to_send += m_write_idx - start + content_len;
+    metrics::count( COUNTER_REQUESTS );
+    metrics::count( COUNTER_STATUS_206 );
     return true;
 }
 
+const struct msghdr* http_conn::send_msg() {
+    struct msghdr& msg = m_buf->msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = m_buf->iv + m_iv_start;
+    msg.msg_iovlen = m_iv_count - m_iv_start;
+    return &msg;
+}
+
+bool http_conn::can_pipeline() const {
+    // 要求关闭连接的请求之后的数据不再处理；sendfile发送的文件内容不在iovec中，只能是最后一个响应；
+    // 生成的响应内容只有一份，也只能是最后一个响应
+    return m_linger && m_file_fd == -1 && m_buf->dynamic_body.empty() && m_request_end >= m_checked_idx &&
+           m_request_end < m_buf->read.size() &&
+           m_file_count < MAX_PIPELINE && m_iv_count + 2 <= MAX_IOV &&
+           WRITE_BUFFER_SIZE - m_write_idx >= MIN_RESPONSE_ROOM;
+}
+
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
 void http_conn::process() {
-    // 解析HTTP请求
+    long long start = metrics::now_ns();
+    metrics::record( HIST_QUEUE_WAIT, start - m_buf->queued_ns );
+
+    // 解析HTTP请求，完整的请求记录解析用时(包括do_request查找文件)
     HTTP_CODE read_ret = process_read();
     if ( read_ret == NO_REQUEST ) {
-        modfd( m_epollfd, m_sockfd, EPOLLIN );
+        // 没有读到任何数据时不必占着缓冲区
+        if ( m_buf->read.size() == 0 ) {
+            release_buffers();
+        } else if ( m_check_state == CHECK_STATE_CONTENT ) {
+            // 头部已经收完，请求体按两次收到数据的间隔计算超时
+            set_deadline( TIMEOUT_BODY );
+        }
+        rearm( EPOLLIN );
         return;
     }
-    
+    metrics::record( HIST_PARSE, metrics::now_ns() - start );
+
     // 生成响应
     bool write_ret = process_write( read_ret );
     if ( !write_ret ) {
         close_conn();
+        return;
     }
-    modfd( m_epollfd, m_sockfd, EPOLLOUT);
-}
\ No newline at end of file
+
+    // 流水线：读缓冲区中已经有后续的完整请求时，接着处理，它们的响应合并到同一次writev中
+    while ( can_pipeline() ) {
+        bool linger = m_linger;
+        init_request( m_request_end );
+        start = metrics::now_ns();
+        read_ret = process_read();
+        if ( read_ret == NO_REQUEST ) {
+            // 下一个请求还不完整，等这一批响应发送完之后再从头解析
+            m_linger = linger;
+            break;
+        }
+        metrics::record( HIST_PARSE, metrics::now_ns() - start );
+        if ( !process_write( read_ret ) ) {
+            close_conn();
+            return;
+        }
+    }
+    set_deadline( TIMEOUT_WRITE );
+    rearm( EPOLLOUT );
+}
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <sys/stat.h>
@@ -19,28 +20,127 @@
 #include <stdarg.h>
 #include <errno.h>
 #include "lock.h"
+#include "stat_cache.h"
+#include "file_registry.h"
+#include "compress_cache.h"
+#include "mime_types.h"
+#include "http_scan.h"
+#include "http_headers.h"
+#include "http_response.h"
+#include "read_buffer.h"
+#include "object_pool.h"
+#include "conn_timers.h"
+#include "log.h"
+#include "metrics.h"
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <iostream>
+#include <atomic>
+#include <string>
 
+class uring_loop;
+
+// 连接对象按缓存行对齐，数据成员按访问它们的线程分组(见类定义末尾)
 class http_conn
 {
-private:
-    // 该HTTP连接的socket和对方的socket地址
-    int m_sockfd;
+public:
+    // 缓存行大小
+    static const int CACHE_LINE = 64;
 
-    // 对方的socket地址
-    sockaddr_in m_address;
+    // 统计用户数量，多个reactor线程和工作线程会同时修改
+    static std::atomic<int> m_user_count;
 
-public:
-    // 所有的socket上的事件都被注册到同一个epoll内核事件表中，所以将epoll文件描述符设置为静态的
-    static int m_epollfd;
+    // 不小于该大小的文件不做mmap，而是保留文件描述符用sendfile发送
+    static off_t m_sendfile_threshold;
+
+    // 所有连接共享的URL到文件路径、stat结果的缓存，为NULL时不使用缓存
+    static stat_cache *m_stat_cache;
+
+    // 所有连接共享的文件映射注册表，由main()创建
+    static file_registry *m_file_registry;
 
-    // 统计用户数量
-    static int m_user_count;
+    // 所有连接共享的gzip压缩版本的缓存，为NULL时只发送预先压缩好的文件
+    static compress_cache *m_compress_cache;
+
+    // 读缓冲区借用的slab池，由main()创建
+    static slab_pool *m_slab_pool;
 
     static const int FILENAME_LEN = 200; // 文件名的最大长度
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int WRITE_BUFFER_SIZE = 2048;
+
+    // 流水线：一次最多合并发送的响应数
+    static const int MAX_PIPELINE = 8;
+    // Range请求最多的片段数，超过时忽略Range，返回整个文件
+    static const int MAX_RANGES = 6;
+    // 需要的iovec个数：每个响应一个响应头加一个文件内容；多段响应只能是最后一个响应，
+    // 每个片段一个分隔行加一段文件内容，再加上结束的分隔行
+    static const int MAX_IOV = 2 * MAX_PIPELINE + 2 * MAX_RANGES;
+    // 写缓冲区剩余空间不足以放下一个响应头(最长的是带有Content-Range和文件头部的206)时，不再合并后面的请求
+    static const int MIN_RESPONSE_ROOM = 512;
+    // format_file_headers()生成的头部的最大长度
+    static const int FILE_HEADERS_MAX = VALIDATOR_HEADERS_MAX + 64;
+    // 响应头中预先生成的部分之外，Content-Length、Content-Type、Connection、Date和空行的最大长度
+    static const int MAX_DYNAMIC_HEADERS = 128;
+
+    // 扫描器一次最多建立索引的行数
+    static const int MAX_SCAN_LINES = 16;
+    // 最多记录的头部字段数
+    static const int MAX_HEADERS = 32;
+
+    // 保留的URL，返回运行统计，分别为便于阅读的文本格式和Prometheus的文本格式
+    static const char METRICS_URL[];
+    static const char METRICS_PROMETHEUS_URL[];
+
+    // 请求中的头部字段，只记录在读缓冲区中的位置
+    struct header_entry
+    {
+        http_span name;
+        http_span value;
+    };
+
+    // Range请求的一个片段，已经按文件大小截断
+    struct byte_range
+    {
+        off_t first;
+        off_t len;
+    };
+
+    // 处理请求期间才需要的缓冲区。连接收到数据时从m_buffer_pool借用，
+    // 响应发送完并且读缓冲区中没有流水线请求(连接空闲)时归还，空闲的长连接只占用http_conn本身
+    struct alignas(CACHE_LINE) conn_buffers
+    {
+        conn_buffers() : validators() { read.set_pool(m_slab_pool); }
+
+        // 读缓冲区，开始时只用内嵌的小块，请求较大时从m_slab_pool借用新的块，请求中的位置都是其中的逻辑偏移量
+        read_buffer read;
+        char write_buf[WRITE_BUFFER_SIZE]; // 写缓冲区
+        char real_file[FILENAME_LEN];      // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
+        struct stat file_stat;             // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
+        file_validators validators;        // 目标文件的ETag和Last-Modified，和file_stat一起从stat缓存中取得
+        bool fresh_stat;                   // 不查stat缓存：缓存的结果与打开的文件不符，正在重新stat
+        const char *content_type;          // 按扩展名确定的Content-Type
+        const char *content_encoding;      // 选中的压缩版本的编码，NULL表示发送未压缩的内容
+        bool vary;                         // 内容可以压缩，响应随Accept-Encoding变化
+        struct iovec iv[MAX_IOV];          // 我们将采用writev来执行写操作
+        struct msghdr msg;                 // io_uring后端用一个sendmsg发送全部iovec时使用，发送完成前必须保持有效
+        file_registry::file *files[MAX_PIPELINE]; // 从注册表中获取的目标文件，全部响应发送完毕后释放
+        compress_cache::variant *variants[MAX_PIPELINE]; // 发送压缩缓存中的版本的响应在此记录，对应的files为NULL
+        scan_line lines[MAX_SCAN_LINES];   // 扫描器建立的行索引，parse_line按顺序取出，取完后再从m_scan_idx继续扫描
+        header_entry headers[MAX_HEADERS];
+
+        long long queued_ns;      // reactor把连接交给线程池的时间，metrics::now_ns()
+        long long request_ns;     // 收到当前请求第一批数据的时间
+        std::string dynamic_body; // 运行时生成的响应内容(运行统计、多段响应的分隔行)，发送完之前不能修改
+
+        byte_range ranges[MAX_RANGES];  // 当前请求要发送的文件片段
+        int range_count;                // 片段数，0表示发送整个文件
+        int part_off[MAX_RANGES + 1];   // 多段响应中各片段的分隔行在dynamic_body中的位置，最后一个是结束的分隔行
+        int range_next;                 // sendfile发送多段响应时，当前片段发完后要发送的下一个分隔行
+        off_t file_end;                 // sendfile当前片段的结束偏移
+    };
+
+    // 所有连接共享的缓冲区池，由main()创建
+    static object_pool<conn_buffers> *m_buffer_pool;
 
     // HTTP请求方法，但我们仅支持GET
     enum METHOD
@@ -74,7 +174,10 @@ public:
         FORBIDDEN_REQUEST, // 客户对资源没有足够的访问权限
         FILE_REQUEST,      // 客户请求的资源可以正常访问
         INTERNAL_ERROR,    // 服务器内部错误
-        CLOSED_CONNECTION  // 客户端已经关闭连接了
+        CLOSED_CONNECTION, // 客户端已经关闭连接了
+        DYNAMIC_REQUEST,   // 请求的是保留的URL，响应内容已经生成在m_buf->dynamic_body中
+        RANGE_NOT_SATISFIABLE, // Range中没有一个片段落在文件内
+        NOT_MODIFIED           // 条件请求的验证器与文件一致，客户端缓存的内容仍然有效
     };
 
     // 从状态机的三种可能状态，即行的读取状态，分别表示
@@ -92,78 +195,191 @@ public:
     // 处理客户端请求
     void process();
 
-    // 初始化新接收的连接
-    void init(int sockfd, const sockaddr_in &addr);
+    // 初始化新接收的连接，epollfd为接受该连接的reactor的epoll，timers为该reactor的超时管理(NULL表示不限制超时)，
+    // uring不为NULL时由io_uring负责该连接的读写
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, conn_timers *timers, uring_loop *uring = NULL);
 
     // 关闭连接
     void close_conn(bool real_close = true);
 
+    // 连接的socket，连接关闭后为-1
+    int sockfd() const { return m_sockfd; }
+
+    // 超时：连接当前的截止时间(monotonic_sec()的秒数)，可能由reactor线程和工作线程修改
+    int deadline() const { return m_deadline.load(std::memory_order_relaxed); }
+    // 把截止时间设为从现在开始的kind类型的超时
+    void set_deadline(timeout_kind kind)
+    {
+        int timeout = conn_timers::m_timeouts[kind];
+        m_deadline.store(timeout > 0 ? monotonic_sec() + timeout : NO_DEADLINE, std::memory_order_relaxed);
+    }
+    // 已经超时，由conn_timers在持有锁时调用。只shutdown socket，连接上挂起的读写随之出错，由正常的路径关闭连接
+    void expire() { shutdown(m_sockfd, SHUT_RDWR); }
+
     // 读取浏览器端发来的全部数据,非阻塞ET工作模式下，需要一次性将数据读完
     bool read();
 
     // 响应报文写入函数,非阻塞ET工作模式下，需要一次性将数据写完
     bool write();
 
+    // 响应已经发送完毕，而读缓冲区中还有客户端以流水线方式发来的请求，
+    // 此时连接没有重新注册读事件，调用者需要把它交给线程池处理
+    bool pipelined() const { return bytes_to_send == 0 && m_buf && m_buf->read.size() > 0; }
+
+    // reactor把连接交给线程池之前调用，记录排队开始的时间
+    void queued() { m_buf->queued_ns = metrics::now_ns(); }
+
+    // 以下函数供io_uring后端使用，由它代替read()/write()完成收发
+    // 追加接收到的数据到读缓冲区，缓冲区放不下时返回false
+    bool feed(const char *data, int len);
+    // 读缓冲区最多还能接收的数据量
+    int read_room() const { return m_buf ? m_buf->read.room() : read_buffer::MAX_SIZE; }
+    // 已经发送了bytes字节，调整待发送的iovec
+    void sent(int bytes);
+    // 待发送的数据，已经发完的iovec长度为0
+    const struct iovec *iov() const { return m_buf->iv + m_iv_start; }
+    int iov_count() const { return m_iv_count - m_iv_start; }
+    // 描述全部待发送iovec的msghdr，保存在借用的缓冲区中，直到sendmsg完成都有效
+    const struct msghdr *send_msg();
+    off_t bytes_left() const { return bytes_to_send; }
+    // 最后一个响应的文件内容是否通过sendfile发送，此时iov中只有响应头(多段响应还有第一个分隔行)
+    bool use_sendfile() const { return m_file_fd != -1; }
+    // 响应头发送完后，用sendfile发送文件内容，多段响应在片段之间自行发送分隔行，
+    // 直到发完或者socket发送缓冲区已满，出错返回false
+    bool send_file();
+    // 响应发送完毕，释放文件映射；保持连接时把尚未处理的请求数据移到读缓冲区开头，
+    // 重置连接状态并返回true
+    bool finish_response();
+
     // 解析HTTP请求
     HTTP_CODE process_read();
     // 填充HTTP应答 
     bool process_write(HTTP_CODE ret); 
-    // 解析HTTP请求行
-    HTTP_CODE parse_request_line(char *text);
+    // 解析HTTP请求行，text为读缓冲区中的一行，不含\r\n，解析时不修改缓冲区
+    HTTP_CODE parse_request_line(const char *text, int len);
     // 解析HTTP请求头部字段
-    HTTP_CODE parse_headers(char *text);
+    HTTP_CODE parse_headers(const char *text, int len);
     // 解析HTTP请求体
-    HTTP_CODE parse_content(char *text);
+    HTTP_CODE parse_content();
+
+    // 请求头部的访问接口，得到的值指向读缓冲区，不以\0结尾，在开始解析下一个请求之前有效
+    // 已知字段按header_id取值，不存在时返回false
+    bool get_header(header_id id, const char **value, int *len) const;
+    // 按字段名(不区分大小写)取值，不存在时返回false
+    bool get_header(const char *name, const char **value, int *len) const;
+    // 按顺序访问所有字段，超出MAX_HEADERS的字段不会被记录
+    int header_count() const { return m_header_count; }
+    void header_at(int i, const char **name, int *name_len, const char **value, int *value_len) const;
 
     //
     LINE_STATUS parse_line();
 
     // 获取一行数据
-    char *get_line() { return m_read_buf + m_start_line; }; // 返回读缓冲区中已经解析的字符
+    const char *get_line() { return m_buf->read.at(m_start_line); }; // 返回读缓冲区中已经解析的字符
 
     HTTP_CODE do_request();
+    // 查找url对应的文件，先查stat缓存，未命中时调用check_file()，结果写入real_file、st和v
+    HTTP_CODE resolve(const char *url, int len, char *real_file, struct stat *st, file_validators *v);
+    // 拼接目标文件的完整路径，stat并判断访问权限
+    HTTP_CODE check_file(const char *url, int len, char *real_file, struct stat *st);
+    // 按Accept-Encoding选择发送的版本，见实现处的说明。选中压缩缓存中的版本时返回它的引用
+    compress_cache::variant *select_encoding(const char *url);
+    // 按If-None-Match和If-Modified-Since判断客户端缓存的内容是否仍然有效
+    bool not_modified() const;
+    // 按Range和If-Range得出要发送的片段，写入m_buf->ranges，返回片段数；
+    // 0表示发送整个文件，-1表示没有一个片段可以满足
+    int parse_range(off_t size);
 
     // 这一组函数被process_write调用以填充HTTP应答。
     void unmap();
-    bool add_response(const char *format, ...);
-    bool add_content(const char *content);
-    bool add_content_type();
-    bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
-    bool add_linger();
-    bool add_blank_line();
+    // extra是插入在Date之前的其他头部字段，每行以\r\n结尾
+    bool add_headers(const canned_response &r, long content_length, const char *content_type = NULL,
+                     const char *extra = NULL, int extra_len = 0);
+    // 生成206响应：单个片段直接发送文件的一段，多个片段生成multipart/byteranges
+    bool add_ranges(int start);
+    // 文件响应共同的头部：ETag、Last-Modified、Vary，not_modified为false时还有Content-Encoding
+    int format_file_headers(char *buf, bool not_modified) const;
 
 private:
-    char m_read_buf[READ_BUFFER_SIZE]; // 读缓冲区
-    int m_read_idx;                    // 标识读缓冲区中已经读入的客户数据的最后一个字节的下一个位置
+    void init();
+
+    // 开始解析从读缓冲区start处开始的下一个请求，不影响写缓冲区和已经生成的响应
+    void init_request(int start);
+
+    // 是否可以继续解析读缓冲区中的下一个请求，并把它的响应和已有的响应合并发送
+    bool can_pipeline() const;
+
+    // 把一段待发送的数据加入iovec，与前一段相邻时直接合并
+    void add_iov(char *base, int len);
+
+    // 重新注册连接上的读(EPOLLIN)或写(EPOLLOUT)事件
+    void rearm(int ev);
+
+    // 读缓冲区中一段的地址，同一行中的内容在内存中总是连续的
+    const char *span_ptr(const http_span &span) const { return m_buf->read.at(span.off); }
 
+    // 收到了数据，这是新请求的第一批数据时开始计算头部超时
+    void request_started();
+
+    // 从m_buffer_pool借用缓冲区，失败返回false
+    bool acquire_buffers();
+    // 归还缓冲区，借用的读缓冲区块一起还给slab池
+    void release_buffers();
+
+    // 数据成员按访问它们的线程分组，每组从新的缓存行开始。相邻的连接对象由不同的线程处理，
+    // 对象按缓存行对齐后不会和邻居共用缓存行；reactor线程每次事件都要读写的字段也不和解析状态共用缓存行。
+    // 大块的缓冲区在m_buf中单独分配，只在处理请求期间借用
+
+    // 第一组：reactor线程每次事件都要访问，工作线程发送响应时修改的连接和发送状态
+    alignas(CACHE_LINE) int m_sockfd;
+    int m_epollfd;      // 该连接所属reactor的epoll文件描述符，多reactor模式下连接始终由接受它的reactor负责
+    uring_loop *m_uring; // 使用io_uring后端时连接所属的ring，为NULL表示使用epoll
+    conn_buffers *m_buf; // 处理请求期间借用的缓冲区，连接空闲时为NULL
+
+    off_t bytes_to_send; // 将要发送的数据的字节数，大文件可能超过2GB
+    int m_iv_count;      // m_buf->iv中被写内存块的数量
+    int m_iv_start;      // 第一个还没有发完的iovec
+    int m_file_fd;       // 大文件不做mmap，使用打开的文件描述符sendfile，只可能是最后一个响应
+    off_t m_file_offset; // sendfile已经发送到的文件偏移
+    bool m_linger;       // HTTP请求是否要求保持连接
+
+public:
+    // 上次处理该连接的工作线程，工作窃取调度时reactor把连接交还给这个线程，
+    // 它的读写缓冲区很可能还在那个核的缓存中。连接关闭后保留，复用同一个对象的新连接也交给它
+    int m_worker;
+
+private:
+    // 第二组：只有处理请求的工作线程使用的解析和响应状态，下面的位置都是读缓冲区中的逻辑偏移量
+    alignas(CACHE_LINE) CHECK_STATE m_check_state; // 主状态机当前所处的状态
     int m_checked_idx; // 当前正在分析的字符在读缓冲区中的位置
     int m_start_line;  // 当前正在解析的行的起始位置
+    int m_line_start;  // parse_line取出的行的起始位置
 
-    CHECK_STATE m_check_state; // 主状态机当前所处的状态
+    int m_line_count;  // 行索引中的行数
+    int m_line_next;   // 下一个要取出的行
+    int m_scan_idx;    // 下次扫描的起始位置，总是某一行的开头
+    int m_line_colon;  // 当前行第一个冒号在行内的位置，没有冒号时为SCAN_NO_COLON
+    int m_line_len;    // 当前行不含\r\n的长度
 
-    void init();
+    METHOD m_method;     // 请求方法
+    http_span m_url;     // 客户请求的目标文件的文件名
+    http_span m_version; // HTTP协议版本号，支持HTTP/1.0和HTTP/1.1
+    int m_content_length;
+    int m_request_end; // 已经解析完的最后一个请求在读缓冲区中的结束位置，后面是流水线中的下一个请求
 
-    char *m_url;     // 客户请求的目标文件的文件名
-    char *m_version; // HTTP协议版本号，我们仅支持HTTP/1.1
-    METHOD m_method; // 请求方法
-    char *m_host;    // 主机名
-    bool m_linger;   // HTTP请求是否要求保持连接
+    int m_header_count;
+    short m_known[HEADER_COUNT]; // 已知字段在m_headers中的下标，-1表示没有该字段
 
-    int m_content_length;
+    int m_write_idx;      // 写缓冲区中待发送的字节数
+    int m_file_count;     // m_buf->files中的文件数
+    char *m_file_address; // 客户请求的目标文件被mmap到内存中的起始位置
 
-private:
-    char m_real_file[FILENAME_LEN];      // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
-    char m_write_buf[WRITE_BUFFER_SIZE]; // 写缓冲区
-    int m_write_idx;                     // 写缓冲区中待发送的字节数
-    char *m_file_address;                // 客户请求的目标文件被mmap到内存中的起始位置
-    struct stat m_file_stat;             // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];                // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
-    int m_iv_count;
-
-    int bytes_to_send;   // 将要发送的数据的字节数
-    int bytes_have_send; // 已经发送的字节数
+    // 第三组：超时管理，reactor每秒tick时访问，连接上的活动只写入m_deadline；以及建立连接时写入、之后不再访问的对方地址
+    alignas(CACHE_LINE) wheel_timer m_timer; // 嵌入的定时器节点，连接打开期间一直在m_timers的时间轮中
+    conn_timers *m_timers;                   // 所属reactor的超时管理，为NULL时不限制超时
+    std::atomic<int> m_deadline;             // 当前的截止时间，定时器到期时对照它决定关闭连接还是重新放回时间轮
+    bool m_request_started;                  // 是否已经收到了下一个请求的数据，头部超时从这时开始计算
+    sockaddr_in m_address;                   // 对方的socket地址
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+#include <strings.h>
+
+// 读缓冲区中的一段，用偏移量和长度表示，解析时不修改缓冲区
+struct http_span
+{
+    int off;
+    int len;
+};
+
+// 服务器关心的请求头部
+enum header_id
+{
+    HEADER_UNKNOWN = -1,
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_IF_RANGE,
+    HEADER_USER_AGENT,
+    HEADER_REFERER,
+    HEADER_COOKIE,
+    HEADER_COUNT
+};
+
+struct known_header
+{
+    const char *name; // 小写的字段名
+    int len;
+};
+
+static constexpr known_header KNOWN_HEADERS[HEADER_COUNT] = {
+    {"host", 4},
+    {"connection", 10},
+    {"content-length", 14},
+    {"content-type", 12},
+    {"transfer-encoding", 17},
+    {"accept", 6},
+    {"accept-encoding", 15},
+    {"if-none-match", 13},
+    {"if-modified-since", 17},
+    {"range", 5},
+    {"if-range", 8},
+    {"user-agent", 10},
+    {"referer", 7},
+    {"cookie", 6},
+};
+
+// 完美哈希：长度、首字符和末字符(都不区分大小写)组合后，上面的字段名恰好落在互不相同的槽位。
+// 增加新的字段名时如果发生冲突，build_header_table()无法在编译期求值，编译会失败，
+// 这时调整乘数或者扩大表即可
+static const int HEADER_TABLE_SIZE = 16;
+
+constexpr char header_lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+constexpr unsigned header_hash(const char *name, int len)
+{
+    return (len + header_lower(name[0]) + 7 * header_lower(name[len - 1])) & (HEADER_TABLE_SIZE - 1);
+}
+
+struct header_table
+{
+    signed char slot[HEADER_TABLE_SIZE]; // 槽位上的header_id，空槽为-1
+};
+
+constexpr header_table build_header_table()
+{
+    header_table t = {};
+    for (int i = 0; i < HEADER_TABLE_SIZE; ++i)
+    {
+        t.slot[i] = -1;
+    }
+    for (int id = 0; id < HEADER_COUNT; ++id)
+    {
+        unsigned h = header_hash(KNOWN_HEADERS[id].name, KNOWN_HEADERS[id].len);
+        // 冲突时抛出异常，使常量求值失败
+        t.slot[h] = t.slot[h] == -1 ? id : throw "header hash collision";
+    }
+    return t;
+}
+
+static constexpr header_table HEADER_TABLE = build_header_table();
+
+// 查找字段名对应的header_id，一次哈希加一次比较，不是已知字段时返回HEADER_UNKNOWN
+inline header_id lookup_header(const char *name, int len)
+{
+    if (len <= 0)
+    {
+        return HEADER_UNKNOWN;
+    }
+    int id = HEADER_TABLE.slot[header_hash(name, len)];
+    if (id < 0 || KNOWN_HEADERS[id].len != len || strncasecmp(name, KNOWN_HEADERS[id].name, len) != 0)
+    {
+        return HEADER_UNKNOWN;
+    }
+    return (header_id)id;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include "http_response.h"
+
+// 定义HTTP响应的一些状态信息
+static const char *status_lines[RESPONSE_COUNT] = {
+    "HTTP/1.1 200 OK\r\n",
+    "HTTP/1.1 206 Partial Content\r\n",
+    "HTTP/1.1 304 Not Modified\r\n",
+    "HTTP/1.1 400 Bad Request\r\n",
+    "HTTP/1.1 403 Forbidden\r\n",
+    "HTTP/1.1 404 Not Found\r\n",
+    "HTTP/1.1 416 Range Not Satisfiable\r\n",
+    "HTTP/1.1 500 Internal Error\r\n",
+};
+
+static const char *error_forms[RESPONSE_COUNT] = {
+    NULL,
+    NULL,
+    NULL,
+    "Your request has bad syntax or is inherently impossible to satisfy.\n",
+    "You do not have permission to get file from this server.\n",
+    "The requested file was not found on this server.\n",
+    "The requested range is not satisfiable.\n",
+    "There was an unusual problem serving the requested file.\n",
+};
+
+// 两位数字的查找表，一次除法得到两位
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int format_uint(char *buf, unsigned long value)
+{
+    // 从低位往高位写到临时缓冲区的末尾，再整体拷贝
+    char tmp[UINT_DIGITS_MAX];
+    char *p = tmp + UINT_DIGITS_MAX;
+    while (value >= 100)
+    {
+        unsigned i = (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        memcpy(p, digit_pairs + i, 2);
+    }
+    if (value >= 10)
+    {
+        p -= 2;
+        memcpy(p, digit_pairs + value * 2, 2);
+    }
+    else
+    {
+        *--p = '0' + value;
+    }
+    int len = tmp + UINT_DIGITS_MAX - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+// 启动后第一次使用时生成全部响应，之后只读
+struct canned_table
+{
+    canned_table()
+    {
+        for (int i = 0; i < RESPONSE_COUNT; ++i)
+        {
+            std::string &h = heads[i];
+            h = status_lines[i];
+            const char *body = error_forms[i];
+            if (body)
+            {
+                char digits[UINT_DIGITS_MAX];
+                h += CONTENT_LENGTH_PREFIX;
+                h.append(digits, format_uint(digits, strlen(body)));
+                h += CONTENT_TYPE_HTML;
+            }
+            responses[i].head = h.c_str();
+            responses[i].head_len = h.size();
+            responses[i].body = body;
+            responses[i].body_len = body ? strlen(body) : 0;
+        }
+    }
+
+    std::string heads[RESPONSE_COUNT];
+    canned_response responses[RESPONSE_COUNT];
+};
+
+const canned_response &canned(response_id id)
+{
+    static canned_table table;
+    return table.responses[id];
+}
+
+int format_http_date(char *buf, time_t t)
+{
+    // 固定使用英文的星期和月份，不受locale影响
+    static const char days[][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char months[][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return snprintf(buf, 64, "%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm.tm_wday], tm.tm_mday,
+                    months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+bool parse_http_date(const char *p, int len, time_t *t)
+{
+    // Sun, 06 Nov 1994 08:49:37 GMT
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    if (len != HTTP_DATE_LEN || p[3] != ',' || p[4] != ' ' || p[7] != ' ' || p[11] != ' ' || p[16] != ' ' ||
+        p[19] != ':' || p[22] != ':' || p[25] != ' ' || memcmp(p + 26, "GMT", 3) != 0)
+    {
+        return false;
+    }
+    static const int digits[] = {5, 6, 12, 13, 14, 15, 17, 18, 20, 21, 23, 24};
+    for (size_t i = 0; i < sizeof(digits) / sizeof(digits[0]); ++i)
+    {
+        if (p[digits[i]] < '0' || p[digits[i]] > '9')
+        {
+            return false;
+        }
+    }
+    const char *month = NULL;
+    for (int i = 0; i < 12 && !month; ++i)
+    {
+        if (memcmp(p + 8, months + 3 * i, 3) == 0)
+        {
+            month = months + 3 * i;
+        }
+    }
+    if (!month)
+    {
+        return false;
+    }
+
+    long day = (p[5] - '0') * 10 + (p[6] - '0');
+    long mon = (month - months) / 3 + 1;
+    long year = (p[12] - '0') * 1000 + (p[13] - '0') * 100 + (p[14] - '0') * 10 + (p[15] - '0');
+    long sec = ((p[17] - '0') * 10 + (p[18] - '0')) * 3600 + ((p[20] - '0') * 10 + (p[21] - '0')) * 60 +
+               (p[23] - '0') * 10 + (p[24] - '0');
+
+    // 从公历日期直接算出距1970-01-01的天数，不经过timegm：把3月当作一年的开始，闰日落在年末
+    year -= mon <= 2;
+    long era = year / 400;
+    long yoe = year - era * 400;
+    long doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    *t = (era * 146097 + doe - 719468) * 86400 + sec;
+    return true;
+}
+
+void make_validators(const struct stat &st, file_validators *v, const char *suffix)
+{
+    // 修改时间精确到纳秒，同一秒内的两次修改也会得到不同的ETag
+    char *p = v->headers;
+    p += sprintf(p, "ETag: ");
+    v->etag_off = p - v->headers;
+    v->etag_len = sprintf(p, "\"%lx-%lx-%lx.%lx%s\"", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+                          (unsigned long)st.st_mtim.tv_sec, (unsigned long)st.st_mtim.tv_nsec, suffix);
+    p += v->etag_len;
+    p += sprintf(p, "\r\nLast-Modified: ");
+    v->date_off = p - v->headers;
+    v->date_len = format_http_date(p, st.st_mtime);
+    p += v->date_len;
+    memcpy(p, "\r\n", 2);
+    v->headers_len = p + 2 - v->headers;
+}
+
+const char *date_header()
+{
+    // 每个线程各缓存一份，不需要同步
+    static thread_local time_t cached_sec = -1;
+    static thread_local char cached[72]; // 比DATE_HEADER_LEN大，年份等字段异常时也不会截断
+
+    time_t now = time(NULL);
+    if (now != cached_sec)
+    {
+        memcpy(cached, "Date: ", 6);
+        int len = 6 + format_http_date(cached + 6, now);
+        memcpy(cached + len, "\r\n", 2);
+        cached_sec = now;
+    }
+    return cached;
+}
@@ -0,0 +1,84 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <time.h>
+#include <sys/stat.h>
+
+// 响应头的快速生成。
+// 状态行和完整的错误响应在启动时生成好，生成响应时只需要拷贝固定的片段，
+// 再写入Content-Length的数字和每秒格式化一次的Date，不再经过vsnprintf。
+
+// 预先生成的响应
+enum response_id
+{
+    RESPONSE_200 = 0,
+    RESPONSE_206,
+    RESPONSE_304,
+    RESPONSE_400,
+    RESPONSE_403,
+    RESPONSE_404,
+    RESPONSE_416,
+    RESPONSE_500,
+    RESPONSE_COUNT
+};
+
+struct canned_response
+{
+    const char *head; // 200、206和304只有状态行；错误响应还包括Content-Length和Content-Type
+    int head_len;
+    const char *body; // 错误响应的内容，作为静态的iovec直接发送，200为NULL
+    int body_len;
+};
+
+const canned_response &canned(response_id id);
+
+// 动态部分的固定片段
+static const char CONTENT_LENGTH_PREFIX[] = "Content-Length: ";
+static const char CONTENT_TYPE_PREFIX[] = "\r\nContent-Type:"; // 结束Content-Length一行，后面是类型和\r\n
+static const char CONTENT_TYPE_HTML[] = "\r\nContent-Type:text/html\r\n"; // 结束Content-Length一行
+static const char CONNECTION_KEEP_ALIVE[] = "Connection: keep-alive\r\n";
+static const char CONNECTION_CLOSE[] = "Connection: close\r\n";
+static const char ACCEPT_RANGES[] = "Accept-Ranges: bytes\r\n";
+static const char VARY_ACCEPT_ENCODING[] = "Vary: Accept-Encoding\r\n";
+static const char CONTENT_ENCODING_PREFIX[] = "Content-Encoding: ";
+
+// 无符号整数的十进制表示的最大长度
+static const int UINT_DIGITS_MAX = 20;
+
+// 把value按十进制写入buf，不写\0，返回写入的字符数。buf至少有UINT_DIGITS_MAX字节
+int format_uint(char *buf, unsigned long value);
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"的长度
+static const int DATE_HEADER_LEN = 37;
+// "Sun, 06 Nov 1994 08:49:37 GMT"的长度
+static const int HTTP_DATE_LEN = 29;
+
+// 把t按HTTP日期格式(IMF-fixdate)写入buf，写入\0，返回不含\0的长度。buf至少有64字节
+int format_http_date(char *buf, time_t t);
+
+// 解析IMF-fixdate格式的HTTP日期，其他格式(RFC 850、asctime)返回false
+bool parse_http_date(const char *p, int len, time_t *t);
+
+// "ETag: ...\r\nLast-Modified: ...\r\n"的最大长度
+static const int VALIDATOR_HEADERS_MAX = 128;
+
+// 文件的验证器：由inode、大小和修改时间生成的强ETag，以及Last-Modified。
+// 由stat结果生成一次，和stat结果一起缓存，生成响应和判断条件请求时直接使用
+struct file_validators
+{
+    char headers[VALIDATOR_HEADERS_MAX]; // 两行完整的头部字段，生成响应时直接拷贝
+    int headers_len;
+    int etag_off; // 带引号的实体标签在headers中的位置
+    int etag_len;
+    int date_off; // Last-Modified的日期在headers中的位置
+    int date_len;
+};
+
+// suffix加在ETag的引号之内，同一个文件的不同编码的版本使用不同的ETag
+void make_validators(const struct stat &st, file_validators *v, const char *suffix = "");
+
+// 当前时间的Date头部，含\r\n，不以\0结尾。每个线程缓存一份，秒数变化时才重新格式化，
+// 返回的内存属于调用线程，下次调用前有效
+const char *date_header();
+
+#endif
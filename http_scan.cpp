@@ -0,0 +1,215 @@
+#include "http_scan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// 扫描过程中的状态
+struct scan_ctx
+{
+    const char *buf;
+    int len;
+    scan_line *lines;
+    int max;
+    int n;          // 已经写入的行数
+    int line_start; // 当前行的开头
+    int colon;      // 当前行第一个冒号的位置
+};
+
+// 处理位置i上的'\r'、'\n'或':'，返回false表示停止扫描
+inline bool on_event(scan_ctx &c, int i)
+{
+    char ch = c.buf[i];
+    if (ch == ':')
+    {
+        if (c.colon == SCAN_NO_COLON)
+        {
+            c.colon = i;
+        }
+        return true;
+    }
+    if (ch == '\r')
+    {
+        // '\r'是最后一个字符时行还不完整，后面是'\n'时由'\n'结束这一行
+        if (i + 1 == c.len)
+        {
+            return false;
+        }
+        if (c.buf[i + 1] == '\n')
+        {
+            return true;
+        }
+        c.lines[c.n].end = i;
+        c.lines[c.n].colon = SCAN_BAD_LINE;
+        ++c.n;
+        return false;
+    }
+
+    // '\n'，是否跟在'\r'后面由调用者检查
+    c.lines[c.n].end = i;
+    c.lines[c.n].colon = c.colon;
+    ++c.n;
+    c.line_start = i + 1;
+    c.colon = SCAN_NO_COLON;
+    return c.n < c.max;
+}
+
+inline void scan_init(scan_ctx &c, const char *buf, int pos, int len, scan_line *lines, int max)
+{
+    c.buf = buf;
+    c.len = len;
+    c.lines = lines;
+    c.max = max;
+    c.n = 0;
+    c.line_start = pos;
+    c.colon = SCAN_NO_COLON;
+}
+
+// 逐字节处理[i, len)，返回false表示停止扫描
+inline bool scan_tail(scan_ctx &c, int i)
+{
+    for (; i < c.len; ++i)
+    {
+        char ch = c.buf[i];
+        if ((ch == '\r' || ch == '\n' || ch == ':') && !on_event(c, i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline int scan_finish(scan_ctx &c, int *pos)
+{
+    *pos = c.line_start;
+    return c.n;
+}
+
+} // namespace
+
+int scan_lines_scalar(const char *buf, int *pos, int len, scan_line *lines, int max)
+{
+    scan_ctx c;
+    scan_init(c, buf, *pos, len, lines, max);
+    if (max > 0)
+    {
+        scan_tail(c, *pos);
+    }
+    return scan_finish(c, pos);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// SSE4.2的PCMPESTRM一条指令比较16个字节与字符集合"\r\n:"，得到命中的位掩码
+__attribute__((target("sse4.2"))) int scan_lines_sse42(const char *buf, int *pos, int len, scan_line *lines, int max)
+{
+    scan_ctx c;
+    scan_init(c, buf, *pos, len, lines, max);
+    if (max <= 0)
+    {
+        return scan_finish(c, pos);
+    }
+
+    const __m128i set = _mm_setr_epi8('\r', '\n', ':', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    int i = *pos;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i hit = _mm_cmpestrm(set, 3, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        unsigned mask = _mm_cvtsi128_si32(hit);
+        while (mask)
+        {
+            if (!on_event(c, i + __builtin_ctz(mask)))
+            {
+                return scan_finish(c, pos);
+            }
+            mask &= mask - 1;
+        }
+    }
+    scan_tail(c, i);
+    return scan_finish(c, pos);
+}
+
+// AVX2每次比较32个字节，三次比较的结果合并成一个位掩码
+__attribute__((target("avx2"))) int scan_lines_avx2(const char *buf, int *pos, int len, scan_line *lines, int max)
+{
+    scan_ctx c;
+    scan_init(c, buf, *pos, len, lines, max);
+    if (max <= 0)
+    {
+        return scan_finish(c, pos);
+    }
+
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i colon = _mm256_set1_epi8(':');
+    int i = *pos;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(data, cr), _mm256_cmpeq_epi8(data, lf)),
+                                      _mm256_cmpeq_epi8(data, colon));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        while (mask)
+        {
+            if (!on_event(c, i + __builtin_ctz(mask)))
+            {
+                return scan_finish(c, pos);
+            }
+            mask &= mask - 1;
+        }
+    }
+    scan_tail(c, i);
+    return scan_finish(c, pos);
+}
+
+static scan_lines_func choose_impl()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return scan_lines_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return scan_lines_sse42;
+    }
+    return scan_lines_scalar;
+}
+
+#else
+
+// 其他架构只有逐字节的实现
+int scan_lines_sse42(const char *buf, int *pos, int len, scan_line *lines, int max)
+{
+    return scan_lines_scalar(buf, pos, len, lines, max);
+}
+
+int scan_lines_avx2(const char *buf, int *pos, int len, scan_line *lines, int max)
+{
+    return scan_lines_scalar(buf, pos, len, lines, max);
+}
+
+static scan_lines_func choose_impl()
+{
+    return scan_lines_scalar;
+}
+
+#endif
+
+scan_lines_func scan_lines = choose_impl();
+
+const char *scan_lines_impl()
+{
+    if (scan_lines == scan_lines_avx2)
+    {
+        return "avx2";
+    }
+    if (scan_lines == scan_lines_sse42)
+    {
+        return "sse4.2";
+    }
+    return "scalar";
+}
@@ -0,0 +1,35 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+// 请求行和头部的向量化扫描器。
+// 一次遍历读缓冲区，找出所有的行结束符和每行第一个冒号，建立偏移量索引，
+// 解析的状态机直接按索引取行，不再逐字节查找\r\n，解析头部时也不用再查找冒号。
+// 运行时根据CPU支持的指令集选择AVX2、SSE4.2或者逐字节的实现。
+
+// 一行的扫描结果
+struct scan_line
+{
+    int end;   // 行尾'\n'在缓冲区中的位置，行出错时为出错字符的位置
+    int colon; // 该行第一个':'的位置，没有冒号时为SCAN_NO_COLON，行出错时为SCAN_BAD_LINE
+};
+
+static const int SCAN_NO_COLON = -1;
+static const int SCAN_BAD_LINE = -2; // 行中有后面不是'\n'的'\r'
+
+// 从buf[*pos, len)中找出完整的行，*pos必须是一行的开头。
+// 最多写入max行，返回写入的行数；*pos更新为第一个没有写入的行的开头，下次从这里继续扫描。
+// 遇到出错的行时写入它之后就停止扫描
+typedef int (*scan_lines_func)(const char *buf, int *pos, int len, scan_line *lines, int max);
+
+// 启动时选择的实现
+extern scan_lines_func scan_lines;
+
+// 各个实现，供基准测试对比
+int scan_lines_scalar(const char *buf, int *pos, int len, scan_line *lines, int max);
+int scan_lines_sse42(const char *buf, int *pos, int len, scan_line *lines, int max);
+int scan_lines_avx2(const char *buf, int *pos, int len, scan_line *lines, int max);
+
+// 当前选择的实现的名称
+const char *scan_lines_impl();
+
+#endif
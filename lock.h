@@ -4,6 +4,11 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <atomic>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 // 互斥锁类
 class locker
@@ -43,6 +48,44 @@ private:
     pthread_mutex_t m_mutex;
 };
 
+// 读写锁类，适合读多写少的共享数据
+class rwlocker
+{
+public:
+    rwlocker()
+    {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0)
+        {
+            throw std::exception();
+        }
+    };
+    ~rwlocker()
+    {
+        pthread_rwlock_destroy(&m_rwlock);
+    };
+
+    // 加读锁
+    bool rdlock()
+    {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    };
+
+    // 加写锁
+    bool wrlock()
+    {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    };
+
+    // 解锁
+    bool unlock()
+    {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    };
+
+private:
+    pthread_rwlock_t m_rwlock;
+};
+
 // 封装条件变量类
 class cond
 {
@@ -128,4 +171,67 @@ public:
     sem_t m_sem;
 };
 
+// 事件计数器，用futex实现的无锁条件变量。
+// 等待者先调用prepare_wait登记自己并取得当前的纪元，再检查一次条件，
+// 条件仍不满足才调用wait睡眠，满足则调用cancel_wait。
+// notify在没有登记的等待者时只是一次原子读，不会进入内核。
+class eventcount
+{
+public:
+    eventcount() : m_epoch(0), m_waiters(0) {}
+
+    // 登记为等待者，返回的纪元传给wait
+    unsigned prepare_wait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    // 登记之后发现条件已经满足，取消等待
+    void cancel_wait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // 纪元没有变化时睡眠，直到被notify唤醒
+    void wait(unsigned epoch)
+    {
+        while (m_epoch.load(std::memory_order_acquire) == epoch)
+        {
+            syscall(SYS_futex, (unsigned *)&m_epoch, FUTEX_WAIT_PRIVATE, epoch, NULL, NULL, 0);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // 在使条件成立(例如入队)之后调用，唤醒一个等待者，没有等待者时返回false
+    bool notify()
+    {
+        // 与prepare_wait中的登记配对：要么这里看到等待者，要么等待者再检查条件时看到新的任务
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0)
+        {
+            return false;
+        }
+        m_epoch.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, (unsigned *)&m_epoch, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        return true;
+    }
+
+    // 唤醒所有等待者
+    void notify_all()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0)
+        {
+            return;
+        }
+        m_epoch.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, (unsigned *)&m_epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+
+private:
+    std::atomic<unsigned> m_epoch;
+    std::atomic<int> m_waiters;
+};
+
 #endif // LOCKER_H
\ No newline at end of file
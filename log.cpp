@@ -0,0 +1,247 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "log.h"
+
+// 一条消息，时间在刷新线程中才格式化
+struct log_record
+{
+    long long time_ns; // CLOCK_REALTIME
+    int level;
+    int len;
+    char text[async_log::MAX_MESSAGE];
+};
+
+// 单生产者单消费者的环：生产者是所属的线程，消费者是刷新线程。
+// 生产者和消费者的位置放在不同的缓存行中，互相不干扰
+struct log_ring
+{
+    alignas(64) std::atomic<unsigned> tail; // 生产者写入的位置
+    int tid;
+    alignas(64) std::atomic<unsigned> head; // 消费者读取的位置
+    alignas(64) std::atomic<unsigned long> dropped;
+    log_record records[async_log::RING_SIZE];
+};
+
+static std::atomic<log_ring *> rings[async_log::MAX_THREADS];
+static std::atomic<int> ring_count(0);
+static std::atomic<unsigned long> dropped_no_ring(0); // 线程数超出MAX_THREADS时丢弃的消息
+static thread_local log_ring *my_ring = NULL;
+
+static int log_fd = -1;
+static pthread_t flusher;
+static std::atomic<bool> running(false);
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+// 当前线程的环，第一次调用时创建并登记
+static log_ring *get_ring()
+{
+    if (my_ring)
+    {
+        return my_ring;
+    }
+    int idx = ring_count.load(std::memory_order_relaxed);
+    if (idx >= async_log::MAX_THREADS)
+    {
+        return NULL;
+    }
+    idx = ring_count.fetch_add(1);
+    if (idx >= async_log::MAX_THREADS)
+    {
+        return NULL;
+    }
+    log_ring *ring = new log_ring;
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->dropped.store(0, std::memory_order_relaxed);
+    ring->tid = syscall(SYS_gettid);
+    rings[idx].store(ring, std::memory_order_release);
+    my_ring = ring;
+    return ring;
+}
+
+void async_log::write(log_level level, const char *format, ...)
+{
+    log_ring *ring = get_ring();
+    if (!ring)
+    {
+        dropped_no_ring.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    unsigned tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->head.load(std::memory_order_acquire) >= (unsigned)RING_SIZE)
+    {
+        // 环满了，丢弃而不是等待
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    log_record &r = ring->records[tail & (RING_SIZE - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    r.time_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    r.level = level;
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(r.text, MAX_MESSAGE, format, args);
+    va_end(args);
+    r.len = len < 0 ? 0 : (len >= MAX_MESSAGE ? MAX_MESSAGE - 1 : len);
+    ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+unsigned long async_log::dropped()
+{
+    unsigned long total = dropped_no_ring.load(std::memory_order_relaxed);
+    int n = ring_count.load(std::memory_order_acquire);
+    for (int i = 0; i < n && i < MAX_THREADS; ++i)
+    {
+        log_ring *ring = rings[i].load(std::memory_order_acquire);
+        if (ring)
+        {
+            total += ring->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+// 刷新线程的输出缓冲区，攒满或者一轮结束时一次写出
+struct flush_buffer
+{
+    static const int SIZE = 64 * 1024;
+    char data[SIZE];
+    int len;
+    time_t last_sec; // 同一秒内的消息复用格式化好的日期
+    char date[32];
+
+    void flush()
+    {
+        int off = 0;
+        while (off < len)
+        {
+            ssize_t n = ::write(log_fd, data + off, len - off);
+            if (n <= 0)
+            {
+                break;
+            }
+            off += n;
+        }
+        len = 0;
+    }
+
+    // 写出一行，时间格式为 2024-01-01 12:00:00.123456
+    void append(long long time_ns, int level, int tid, const char *text, int text_len)
+    {
+        if (len + text_len + 64 > SIZE)
+        {
+            flush();
+        }
+        time_t sec = time_ns / 1000000000LL;
+        if (sec != last_sec)
+        {
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+            last_sec = sec;
+        }
+        len += snprintf(data + len, SIZE - len, "%s.%06d %-5s [%d] ", date,
+                        (int)(time_ns % 1000000000LL / 1000), level_names[level], tid);
+        memcpy(data + len, text, text_len);
+        len += text_len;
+        data[len++] = '\n';
+    }
+};
+
+// 取出所有环中的消息，返回取出的条数
+static int drain(flush_buffer *out, unsigned long *reported_dropped)
+{
+    int total = 0;
+    int n = ring_count.load(std::memory_order_acquire);
+    for (int i = 0; i < n && i < async_log::MAX_THREADS; ++i)
+    {
+        log_ring *ring = rings[i].load(std::memory_order_acquire);
+        if (!ring)
+        {
+            continue;
+        }
+        unsigned head = ring->head.load(std::memory_order_relaxed);
+        unsigned tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head)
+        {
+            const log_record &r = ring->records[head & (async_log::RING_SIZE - 1)];
+            out->append(r.time_ns, r.level, ring->tid, r.text, r.len);
+            ++total;
+        }
+        // 整个环处理完再归还位置，生产者这期间最多看到环是满的
+        ring->head.store(head, std::memory_order_release);
+    }
+
+    unsigned long dropped = async_log::dropped();
+    if (dropped != *reported_dropped)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        char text[96];
+        int len = snprintf(text, sizeof(text), "log rings full, %lu messages dropped (%lu in total)",
+                           dropped - *reported_dropped, dropped);
+        out->append(ts.tv_sec * 1000000000LL + ts.tv_nsec, LOG_LEVEL_WARN, (int)syscall(SYS_gettid), text, len);
+        *reported_dropped = dropped;
+    }
+    out->flush();
+    return total;
+}
+
+static void *flush_loop(void *)
+{
+    flush_buffer *out = new flush_buffer;
+    out->len = 0;
+    out->last_sec = -1;
+    unsigned long reported_dropped = 0;
+    while (running.load(std::memory_order_acquire))
+    {
+        if (drain(out, &reported_dropped) == 0)
+        {
+            usleep(async_log::FLUSH_INTERVAL_MS * 1000);
+        }
+    }
+    drain(out, &reported_dropped);
+    delete out;
+    return NULL;
+}
+
+bool async_log::init(const char *path)
+{
+    if (running.load())
+    {
+        return true;
+    }
+    log_fd = path ? open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : STDOUT_FILENO;
+    if (log_fd < 0)
+    {
+        return false;
+    }
+    running.store(true);
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0)
+    {
+        running.store(false);
+        return false;
+    }
+    return true;
+}
+
+void async_log::stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+    pthread_join(flusher, NULL);
+    if (log_fd != STDOUT_FILENO)
+    {
+        close(log_fd);
+    }
+}
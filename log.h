@@ -0,0 +1,58 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+
+// 异步日志。每个线程第一次写日志时创建自己的环形缓冲区，写日志只是把格式化好的消息放进自己的环中，
+// 不加锁也不做系统调用；后台的刷新线程轮询所有线程的环，把消息攒成一大块后一次write到文件。
+// 环满时丢弃消息并计数，不会阻塞写日志的线程，刷新线程会在日志中报告丢弃的条数。
+// 低于LOG_MIN_LEVEL的级别在编译时就被去掉，参数也不会被求值
+
+enum log_level
+{
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+// 编译时的最低级别，可以用-DLOG_MIN_LEVEL=0打开调试日志
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, ...)                          \
+    do                                              \
+    {                                               \
+        if ((level) >= LOG_MIN_LEVEL)               \
+        {                                           \
+            async_log::write((level), __VA_ARGS__); \
+        }                                           \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+class async_log
+{
+public:
+    static const int MAX_MESSAGE = 232;  // 一条消息的最大长度，超出的部分被截掉
+    static const int RING_SIZE = 1024;   // 每个线程的环中的消息数，必须是2的幂
+    static const int MAX_THREADS = 256;  // 最多写日志的线程数，超出的线程的日志全部丢弃
+    static const int FLUSH_INTERVAL_MS = 20; // 没有消息时刷新线程的轮询间隔
+
+    // 打开日志文件(追加写入)并启动刷新线程，path为NULL时写到标准输出。失败返回false
+    static bool init(const char *path);
+    // 写出所有剩下的消息，停止刷新线程
+    static void stop();
+
+    // 写一条日志，由LOG_*宏调用
+    static void write(log_level level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    // 因为环满而丢弃的消息总数
+    static unsigned long dropped();
+};
+
+#endif
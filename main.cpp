@@ -11,11 +11,16 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <sched.h>
 #include "http_conn.h"
+#include "config.h"
+#include "uring.h"
+#include "conn_table.h"
+#include <sys/resource.h>
 #include <sys/epoll.h>
 #include <cstdio>
 
-#define MAX_FD 65535           // 最大的文件描述符个数
+#define MAX_FD_LIMIT 1048576    // 文件描述符个数的上限，进程的RLIMIT_NOFILE更小时以它为准
 #define MAX_EVENT_NUMBER 10000 // 最大的事件数
 
 // 添加信号捕捉函数
@@ -35,32 +40,37 @@ extern void addfd(int epollfd, int fd, bool one_shot);
 extern void removefd(int epollfd, int fd);
 // 修改文件描述符
 extern void modfd(int epollfd, int fd, int ev);
+// 文件描述符耗尽时丢弃一个等待接受的连接
+extern bool shed_connection(int listenfd, int *spare_fd);
+// 网站的根目录
+extern const char* doc_root;
 
+// 每个reactor线程拥有自己的监听socket和epoll对象，连接的读写始终在接受它的reactor上完成
+struct reactor
+{
+    int id;
+    int listenfd;
+    int epollfd;
+    int spare_fd; // 预留的文件描述符，文件描述符耗尽时用来丢弃连接
+    conn_timers* timers; // 该reactor上连接的超时管理，timerfd注册在epoll中
+    pthread_t tid;
+};
 
+// 所有reactor共享的线程池和连接表，文件描述符在进程内唯一，所以可以直接用fd作为下标
+static threadpool< http_conn >* pool = NULL;
+static conn_table* users = NULL;
+static server_config config;
 
-int main( int argc, char* argv[] ) {
-    
-    if( argc <= 1 ) {
-        printf( "usage: %s port_number\n", basename(argv[0]));
-        return 1;
+// 创建监听socket，多reactor模式下开启SO_REUSEPORT，由内核把新连接分摊到各个监听socket上
+int open_listenfd( int port, bool reuseport, int backlog ) {
+    // 监听socket和接受的连接都是非阻塞的，这样才能循环accept直到EAGAIN
+    int listenfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( listenfd < 0 ) {
+        return -1;
     }
 
-    int port = atoi( argv[1] );
-    addsig( SIGPIPE, SIG_IGN );
-
-    threadpool< http_conn >* pool = NULL;
-    try {
-        pool = new threadpool<http_conn>;
-    } catch( ... ) {
-        return 1;
-    }
-
-    http_conn* users = new http_conn[ MAX_FD ];
-
-    int listenfd = socket( PF_INET, SOCK_STREAM, 0 );
-
-    int ret = 0;
     struct sockaddr_in address;
+    memset( &address, '\0', sizeof( address ) );
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_family = AF_INET;
     address.sin_port = htons( port );
@@ -68,71 +78,274 @@ int main( int argc, char* argv[] ) {
     // 端口复用
     int reuse = 1;
     setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
-    ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
-    ret = listen( listenfd, 5 );
+    if( reuseport ) {
+        setsockopt( listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof( reuse ) );
+    }
+    if( bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) ) < 0
+        || listen( listenfd, backlog ) < 0 ) {
+        close( listenfd );
+        return -1;
+    }
+    return listenfd;
+}
+
+// 把收到请求的连接交给线程池。队列满时连接上的EPOLLONESHOT事件已经用掉，不会再被唤醒，只能关闭
+void dispatch( http_conn* conn ) {
+    conn->queued();
+    if( !pool->append( conn ) ) {
+        metrics::count( COUNTER_QUEUE_REJECTIONS );
+        conn->close_conn();
+    }
+}
+
+// 监听socket是边缘触发的，所以每次都要接受监听队列中所有的连接，直到EAGAIN。
+// 为了不让连接风暴饿死已有连接的读写，每次最多接受config.accept_batch个连接，
+// 达到上限时返回true，表示还有连接没有接受
+bool accept_conns( reactor* r ) {
+    for( int n = 0; n < config.accept_batch; ++n ) {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof( client_address );
+        int connfd = accept4( r->listenfd, ( struct sockaddr* )&client_address, &client_addrlength,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+        if ( connfd < 0 ) {
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                return false;
+            }
+            if( errno == EINTR || errno == ECONNABORTED ) {
+                continue;
+            }
+            if( errno == EMFILE || errno == ENFILE ) {
+                if( shed_connection( r->listenfd, &r->spare_fd ) ) {
+                    continue;
+                }
+                return false;
+            }
+            LOG_ERROR( "accept failed, errno is: %d", errno );
+            return false;
+        }
+
+        if( connfd >= users->max_fd() || http_conn::m_user_count >= users->max_fd() ) {
+            close(connfd);
+            continue;
+        }
+        users->get( connfd )->init( connfd, client_address, r->epollfd, r->timers );
+    }
+    return true;
+}
+
+// reactor的事件循环
+void* reactor_loop( void* arg ) {
+    reactor* r = ( reactor* )arg;
+    int listenfd = r->listenfd;
+    int epollfd = r->epollfd;
+
+    if( config.io_uring ) {
+        uring_loop* loop = new uring_loop( listenfd, users, pool, &r->spare_fd, r->timers );
+        if( loop->init() ) {
+            loop->run();
+            delete loop;
+            return r;
+        }
+        // 内核不支持io_uring(或者缺少需要的特性)时使用epoll
+        LOG_WARN( "reactor %d: io_uring unavailable, fall back to epoll", r->id );
+        delete loop;
+    }
+
+    // 事件数组较大，放在堆上以免撑爆线程栈
+    epoll_event* events = new epoll_event[ MAX_EVENT_NUMBER ];
+    addfd( epollfd, r->timers->fd(), false );
 
-    // 创建epoll对象，和事件数组，添加
-    epoll_event events[ MAX_EVENT_NUMBER ];
-    int epollfd = epoll_create( 5 );
-    // 添加到epoll对象中
-    addfd( epollfd, listenfd, false );
-    http_conn::m_epollfd = epollfd;
+    // 上一轮是否因为达到上限而还有连接没有接受，如果是，本轮不阻塞等待
+    bool accept_pending = false;
 
     while(true) {
-        
-        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, -1 );
-        
+
+        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, accept_pending ? 0 : -1 );
+
         if ( ( number < 0 ) && ( errno != EINTR ) ) {
-            printf( "epoll failure\n" );
+            LOG_ERROR( "reactor %d: epoll failure, errno is: %d", r->id, errno );
             break;
         }
 
+        bool accepted = false;
         for ( int i = 0; i < number; i++ ) {
-            
+
             int sockfd = events[i].data.fd;
-            
+
             if( sockfd == listenfd ) {
-                
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof( client_address );
-                int connfd = accept( listenfd, ( struct sockaddr* )&client_address, &client_addrlength );
-                
-                if ( connfd < 0 ) {
-                    printf( "errno is: %d\n", errno );
-                    continue;
-                } 
 
-                if( http_conn::m_user_count >= MAX_FD ) {
-                    close(connfd);
-                    continue;
-                }
-                users[connfd].init( connfd, client_address);
+                accept_pending = accept_conns( r );
+                accepted = true;
+
+            } else if( sockfd == r->timers->fd() ) {
+
+                // 每秒一次，批量关闭超时的连接
+                r->timers->tick();
 
             } else if( events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) {
 
-                users[sockfd].close_conn();
+                users->get( sockfd )->close_conn();
 
             } else if(events[i].events & EPOLLIN) {
 
-                if(users[sockfd].read()) {
-                    pool->append(users + sockfd);
+                if(users->get( sockfd )->read()) {
+                    dispatch(users->get( sockfd ));
                 } else {
-                    users[sockfd].close_conn();
+                    users->get( sockfd )->close_conn();
                 }
 
             }  else if( events[i].events & EPOLLOUT ) {
 
-                if( !users[sockfd].write() ) {
-                    users[sockfd].close_conn();
+                if( !users->get( sockfd )->write() ) {
+                    users->get( sockfd )->close_conn();
+                } else if( users->get( sockfd )->pipelined() ) {
+                    // 读缓冲区中还有流水线请求
+                    dispatch( users->get( sockfd ) );
                 }
 
             }
         }
+
+        // 处理完本轮的读写事件之后，继续接受上一轮剩下的连接
+        if( accept_pending && !accepted ) {
+            accept_pending = accept_conns( r );
+        }
+    }
+
+    delete [] events;
+    return r;
+}
+
+int main( int argc, char* argv[] ) {
+
+    if( !config.parse_arg( argc, argv ) ) {
+        printf( "usage: %s port_number [-r reactor_number] [-i epoll|uring] [-s sendfile_threshold] [-c stat_cache_size] [-m file_cache_mb]\n       [-z compress_cache_mb] [-b backlog] [-a accept_batch] [-w global|steal] [-t header,body,write,idle]\n       [-l log_file] [-d doc_root]\n", basename(argv[0]));
+        return 1;
+    }
+
+    // 日志由后台线程写出，请求处理路径上不再直接printf
+    if( !async_log::init( config.log_file ) ) {
+        printf( "open log file %s failed, errno is: %d\n", config.log_file, errno );
+        return 1;
+    }
+
+    addsig( SIGPIPE, SIG_IGN );
+    if( config.doc_root ) {
+        doc_root = config.doc_root;
+    }
+    http_conn::m_sendfile_threshold = config.sendfile_threshold;
+    for( int i = 0; i < TIMEOUT_KINDS; ++i ) {
+        conn_timers::m_timeouts[i] = config.timeouts[i];
     }
-    
-    close( epollfd );
-    close( listenfd );
-    delete [] users;
+
+    // 文件映射注册表，同时最多保持打开的大文件数取决于进程的文件描述符上限，这里取一个保守值
+    file_registry* registry = new file_registry( ( size_t )config.file_cache_mb * 1024 * 1024, 1024 );
+    http_conn::m_file_registry = registry;
+
+    // 读缓冲区借用的slab池，空闲时最多缓存4096个slab(32MB)
+    slab_pool* slabs = new slab_pool( 4096 );
+    http_conn::m_slab_pool = slabs;
+    // 处理请求时借用的缓冲区，空闲时最多缓存1024份
+    object_pool< http_conn::conn_buffers >* buffers = new object_pool< http_conn::conn_buffers >( 1024 );
+    http_conn::m_buffer_pool = buffers;
+
+    // 文件状态缓存，inotify不可用时不使用缓存，以免返回过期的结果
+    stat_cache* cache = NULL;
+    if( config.stat_cache_size > 0 ) {
+        cache = new stat_cache( doc_root, config.stat_cache_size );
+        if( cache->start() ) {
+            http_conn::m_stat_cache = cache;
+        } else {
+            LOG_WARN( "inotify on %s failed, stat cache disabled", doc_root );
+        }
+    }
+
+    // 压缩缓存，zlib不可用时只发送预先压缩好的文件
+    compress_cache* compressor = NULL;
+    if( config.compress_cache_mb > 0 ) {
+        compressor = new compress_cache( ( size_t )config.compress_cache_mb * 1024 * 1024 );
+        if( compressor->start() ) {
+            http_conn::m_compress_cache = compressor;
+        } else {
+            LOG_WARN( "libz.so.1 not available, on-the-fly compression disabled" );
+            delete compressor;
+            compressor = NULL;
+        }
+    }
+
+    try {
+        pool = new threadpool<http_conn>( 8, 10000, config.work_stealing ? SCHEDULE_STEALING : SCHEDULE_GLOBAL );
+    } catch( ... ) {
+        return 1;
+    }
+
+    // 文件描述符上限提高到硬限制。连接表只在用到时才分配连接对象，上限很大也不会预先占用内存
+    struct rlimit rl;
+    getrlimit( RLIMIT_NOFILE, &rl );
+    if( rl.rlim_cur < rl.rlim_max ) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &rl );
+        getrlimit( RLIMIT_NOFILE, &rl );
+    }
+    users = new conn_table( rl.rlim_cur < MAX_FD_LIMIT ? ( int )rl.rlim_cur : MAX_FD_LIMIT );
+
+    // 单reactor时保持原来的监听方式，多reactor时每个reactor各自监听同一端口
+    bool reuseport = config.reactor_num > 1;
+    int cpu_num = sysconf( _SC_NPROCESSORS_ONLN );
+    reactor* reactors = new reactor[ config.reactor_num ];
+    for( int i = 0; i < config.reactor_num; ++i ) {
+        reactors[i].id = i;
+        reactors[i].listenfd = open_listenfd( config.port, reuseport, config.backlog );
+        if( reactors[i].listenfd < 0 ) {
+            printf( "listen on port %d failed, errno is: %d\n", config.port, errno );
+            return 1;
+        }
+        // 创建epoll对象，并将监听socket添加到epoll对象中
+        reactors[i].epollfd = epoll_create( 5 );
+        reactors[i].spare_fd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+        reactors[i].timers = new conn_timers;
+        if( !reactors[i].timers->init() ) {
+            printf( "create timerfd failed, errno is: %d\n", errno );
+            return 1;
+        }
+        addfd( reactors[i].epollfd, reactors[i].listenfd, false );
+    }
+
+    // reactor 0 在主线程中运行，其余的reactor各自一个线程。
+    // 所有reactor都绑定到各自的CPU上(reactor i在CPU i % cpu_num)，主线程最后绑定，之前创建的线程不会继承它的绑定
+    reactors[0].tid = pthread_self();
+    for( int i = 1; i < config.reactor_num; ++i ) {
+        if( pthread_create( &reactors[i].tid, NULL, reactor_loop, reactors + i ) != 0 ) {
+            printf( "create reactor %d failed\n", i );
+            return 1;
+        }
+    }
+    for( int i = 0; i < config.reactor_num; ++i ) {
+        cpu_set_t cpuset;
+        CPU_ZERO( &cpuset );
+        CPU_SET( i % cpu_num, &cpuset );
+        pthread_setaffinity_np( reactors[i].tid, sizeof( cpuset ), &cpuset );
+    }
+    reactor_loop( reactors );
+
+    for( int i = 1; i < config.reactor_num; ++i ) {
+        pthread_join( reactors[i].tid, NULL );
+    }
+    for( int i = 0; i < config.reactor_num; ++i ) {
+        close( reactors[i].epollfd );
+        close( reactors[i].listenfd );
+        close( reactors[i].spare_fd );
+        delete reactors[i].timers;
+    }
+    delete [] reactors;
+    delete users;
+    delete buffers;
+    delete slabs;
     delete pool;
+    delete registry;
+    delete compressor;
+    async_log::stop();
+    // 监视线程可能仍在使用缓存，进程退出时由系统回收
     return 0;
-}
\ No newline at end of file
+}
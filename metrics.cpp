@@ -0,0 +1,188 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+
+static std::atomic<metrics::shard *> shards[metrics::MAX_THREADS];
+static std::atomic<int> shard_count(0);
+
+// 进程启动的时间，用于计算运行时长
+static const long long start_ns = metrics::now_ns();
+
+static const char *status_names[] = {"200", "206", "304", "400", "403", "404", "416", "500"};
+
+static const char *hist_names[HIST_KINDS] = {"queue_wait", "parse", "ttlb"};
+
+// 查看统计时使用的一个直方图的合并结果
+struct merged_histogram
+{
+    unsigned long buckets[metrics::BUCKETS];
+    unsigned long count;
+    unsigned long sum;
+
+    // 第q分位数，取所在桶的上界，不超过记录的最大值所在的桶
+    unsigned long quantile(double q) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        unsigned long rank = (unsigned long)(q * count);
+        if (rank >= count)
+        {
+            rank = count - 1;
+        }
+        unsigned long seen = 0;
+        for (int b = 0; b < metrics::BUCKETS; ++b)
+        {
+            seen += buckets[b];
+            if (seen > rank)
+            {
+                return b + 1 < metrics::BUCKETS ? metrics::bucket_floor(b + 1) - 1 : metrics::bucket_floor(b);
+            }
+        }
+        return 0;
+    }
+};
+
+metrics::shard *metrics::attach()
+{
+    int idx = shard_count.fetch_add(1);
+    if (idx >= MAX_THREADS)
+    {
+        // 分片用完了，共用最后一个
+        shard_count.store(MAX_THREADS);
+        shard *last = shards[MAX_THREADS - 1].load(std::memory_order_acquire);
+        while (!last)
+        {
+            last = shards[MAX_THREADS - 1].load(std::memory_order_acquire);
+        }
+        return last;
+    }
+    shard *s = new shard;
+    memset((void *)s, 0, sizeof(shard));
+    shards[idx].store(s, std::memory_order_release);
+    return s;
+}
+
+// 合并所有分片
+static void merge(unsigned long *counters, merged_histogram *hists)
+{
+    memset(counters, 0, sizeof(unsigned long) * COUNTER_KINDS);
+    memset((void *)hists, 0, sizeof(merged_histogram) * HIST_KINDS);
+    int n = shard_count.load(std::memory_order_acquire);
+    for (int i = 0; i < n && i < metrics::MAX_THREADS; ++i)
+    {
+        metrics::shard *s = shards[i].load(std::memory_order_acquire);
+        if (!s)
+        {
+            continue;
+        }
+        for (int c = 0; c < COUNTER_KINDS; ++c)
+        {
+            counters[c] += s->counters[c].load(std::memory_order_relaxed);
+        }
+        for (int h = 0; h < HIST_KINDS; ++h)
+        {
+            for (int b = 0; b < metrics::BUCKETS; ++b)
+            {
+                unsigned long v = s->buckets[h][b].load(std::memory_order_relaxed);
+                hists[h].buckets[b] += v;
+                hists[h].count += v;
+            }
+            hists[h].sum += s->sums[h].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// 追加格式化的文本
+static void appendf(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string &out, const char *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len > 0)
+    {
+        out.append(line, len < (int)sizeof(line) ? len : (int)sizeof(line) - 1);
+    }
+}
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+std::string metrics::render(bool prometheus, int connections)
+{
+    unsigned long counters[COUNTER_KINDS];
+    merged_histogram *hists = new merged_histogram[HIST_KINDS];
+    merge(counters, hists);
+    double uptime = (now_ns() - start_ns) / 1e9;
+
+    std::string out;
+    out.reserve(4096);
+    if (prometheus)
+    {
+        appendf(out, "# TYPE webserver_uptime_seconds gauge\nwebserver_uptime_seconds %.3f\n", uptime);
+        appendf(out, "# TYPE webserver_connections gauge\nwebserver_connections %d\n", connections);
+        appendf(out, "# TYPE webserver_accepts_total counter\nwebserver_accepts_total %lu\n", counters[COUNTER_ACCEPTS]);
+        appendf(out, "# TYPE webserver_responses_total counter\n");
+        for (int i = 0; i < COUNTER_BYTES_SENT - COUNTER_STATUS_200; ++i)
+        {
+            appendf(out, "webserver_responses_total{status=\"%s\"} %lu\n", status_names[i], counters[COUNTER_STATUS_200 + i]);
+        }
+        appendf(out, "# TYPE webserver_sent_bytes_total counter\nwebserver_sent_bytes_total %lu\n", counters[COUNTER_BYTES_SENT]);
+        appendf(out, "# TYPE webserver_queue_rejections_total counter\nwebserver_queue_rejections_total %lu\n",
+                counters[COUNTER_QUEUE_REJECTIONS]);
+        appendf(out, "# TYPE webserver_timeouts_total counter\nwebserver_timeouts_total %lu\n", counters[COUNTER_TIMEOUTS]);
+        appendf(out, "# TYPE webserver_stat_cache_hits_total counter\nwebserver_stat_cache_hits_total %lu\n",
+                counters[COUNTER_STAT_CACHE_HITS]);
+        appendf(out, "# TYPE webserver_stat_cache_misses_total counter\nwebserver_stat_cache_misses_total %lu\n",
+                counters[COUNTER_STAT_CACHE_MISSES]);
+        appendf(out, "# TYPE webserver_compressed_responses_total counter\nwebserver_compressed_responses_total %lu\n",
+                counters[COUNTER_COMPRESSED]);
+        appendf(out, "# TYPE webserver_compress_cache_misses_total counter\nwebserver_compress_cache_misses_total %lu\n",
+                counters[COUNTER_COMPRESS_MISSES]);
+        appendf(out, "# TYPE webserver_recv_nobufs_total counter\nwebserver_recv_nobufs_total %lu\n",
+                counters[COUNTER_RECV_NOBUFS]);
+        for (int h = 0; h < HIST_KINDS; ++h)
+        {
+            // 直方图按summary输出，分位数以秒为单位
+            appendf(out, "# TYPE webserver_%s_seconds summary\n", hist_names[h]);
+            for (double q : quantiles)
+            {
+                appendf(out, "webserver_%s_seconds{quantile=\"%g\"} %.9f\n", hist_names[h], q, hists[h].quantile(q) / 1e9);
+            }
+            appendf(out, "webserver_%s_seconds_sum %.9f\n", hist_names[h], hists[h].sum / 1e9);
+            appendf(out, "webserver_%s_seconds_count %lu\n", hist_names[h], hists[h].count);
+        }
+    }
+    else
+    {
+        appendf(out, "uptime_seconds %.3f\n", uptime);
+        appendf(out, "connections %d\n", connections);
+        appendf(out, "accepts %lu\n", counters[COUNTER_ACCEPTS]);
+        appendf(out, "responses %lu\n", counters[COUNTER_REQUESTS]);
+        for (int i = 0; i < COUNTER_BYTES_SENT - COUNTER_STATUS_200; ++i)
+        {
+            appendf(out, "responses_%s %lu\n", status_names[i], counters[COUNTER_STATUS_200 + i]);
+        }
+        appendf(out, "bytes_sent %lu\n", counters[COUNTER_BYTES_SENT]);
+        appendf(out, "queue_rejections %lu\n", counters[COUNTER_QUEUE_REJECTIONS]);
+        appendf(out, "timeouts %lu\n", counters[COUNTER_TIMEOUTS]);
+        appendf(out, "stat_cache_hits %lu\n", counters[COUNTER_STAT_CACHE_HITS]);
+        appendf(out, "stat_cache_misses %lu\n", counters[COUNTER_STAT_CACHE_MISSES]);
+        appendf(out, "compressed_responses %lu\n", counters[COUNTER_COMPRESSED]);
+        appendf(out, "compress_cache_misses %lu\n", counters[COUNTER_COMPRESS_MISSES]);
+        appendf(out, "recv_nobufs %lu\n", counters[COUNTER_RECV_NOBUFS]);
+        for (int h = 0; h < HIST_KINDS; ++h)
+        {
+            const merged_histogram &m = hists[h];
+            appendf(out, "%s_ns count=%lu mean=%lu p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n", hist_names[h], m.count,
+                    m.count ? m.sum / m.count : 0, m.quantile(0.5), m.quantile(0.9), m.quantile(0.99), m.quantile(0.999),
+                    m.quantile(1.0));
+        }
+    }
+    delete[] hists;
+    return out;
+}
@@ -0,0 +1,134 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+#include <atomic>
+#include <string>
+
+// 服务器的运行统计。每个线程第一次记录时创建自己的分片，记录只修改本线程的分片：
+// 计数器和直方图的桶都只有一个写者，用relaxed的读和写代替原子加法，在x86上就是普通的加法指令。
+// 查看统计时把所有分片合并，读到的是各分片在那一刻的近似值。
+// 延迟直方图采用HDR式的对数-线性分桶：每个2的幂区间再均分为16个子桶，相对误差不超过1/16
+
+// 计数器
+enum metric_counter
+{
+    COUNTER_ACCEPTS = 0,      // 接受的连接数
+    COUNTER_REQUESTS,         // 生成的响应数
+    COUNTER_STATUS_200,       // 各种状态码的响应数，顺序与response_id相同
+    COUNTER_STATUS_206,
+    COUNTER_STATUS_304,
+    COUNTER_STATUS_400,
+    COUNTER_STATUS_403,
+    COUNTER_STATUS_404,
+    COUNTER_STATUS_416,
+    COUNTER_STATUS_500,
+    COUNTER_BYTES_SENT,       // 发送的字节数，包括响应头
+    COUNTER_QUEUE_REJECTIONS, // 线程池队列已满而被拒绝(随后关闭)的连接数
+    COUNTER_TIMEOUTS,         // 因为超时被关闭的连接数
+    COUNTER_STAT_CACHE_HITS,  // 文件状态缓存命中和未命中的次数
+    COUNTER_STAT_CACHE_MISSES,
+    COUNTER_COMPRESSED,       // 发送了压缩版本的响应数，包括预先压缩好的文件和压缩缓存中的版本
+    COUNTER_COMPRESS_MISSES,  // 客户端接受gzip，但压缩缓存中还没有该文件的压缩版本的次数
+    COUNTER_RECV_NOBUFS,      // io_uring缓冲区环用完，recv暂停等待缓冲区归还的次数
+    COUNTER_KINDS
+};
+
+// 延迟直方图，单位纳秒
+enum metric_histogram
+{
+    HIST_QUEUE_WAIT = 0, // 从reactor把连接交给线程池到工作线程开始处理
+    HIST_PARSE,          // 解析一个请求
+    HIST_TTLB,           // 从收到请求的第一个字节到响应的最后一个字节发出，流水线中的一批响应记录一次
+    HIST_KINDS
+};
+
+class metrics
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_EXP = 40; // 超过2^41纳秒(约36分钟)的值记在最后一个桶中
+    static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_BUCKETS;
+    static const int MAX_THREADS = 256; // 超出的线程共用最后一个分片，这时的记录不保证准确
+
+    // 一个线程的分片
+    struct alignas(64) shard
+    {
+        std::atomic<unsigned long> counters[COUNTER_KINDS];
+        std::atomic<unsigned long> buckets[HIST_KINDS][BUCKETS];
+        std::atomic<unsigned long> sums[HIST_KINDS];
+    };
+
+    // 单调时钟，纳秒
+    static long long now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    static void count(metric_counter c, unsigned long n = 1)
+    {
+        add(local()->counters[c], n);
+    }
+
+    static void record(metric_histogram h, long long ns)
+    {
+        shard *s = local();
+        unsigned long v = ns < 0 ? 0 : ns;
+        add(s->buckets[h][bucket_of(v)], 1);
+        add(s->sums[h], v);
+    }
+
+    // 值所在的桶：小于16的值各占一个桶，之后每个2的幂区间分成16个桶
+    static int bucket_of(unsigned long v)
+    {
+        if (v < (unsigned long)SUB_BUCKETS)
+        {
+            return v;
+        }
+        int exp = 63 - __builtin_clzl(v);
+        if (exp > MAX_EXP)
+        {
+            return BUCKETS - 1;
+        }
+        return (exp - SUB_BITS + 1) * SUB_BUCKETS + ((v >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    // 桶中最小的值
+    static unsigned long bucket_floor(int b)
+    {
+        if (b < SUB_BUCKETS)
+        {
+            return b;
+        }
+        int exp = b / SUB_BUCKETS + SUB_BITS - 1;
+        return (unsigned long)(SUB_BUCKETS + b % SUB_BUCKETS) << (exp - SUB_BITS);
+    }
+
+    // 合并所有分片，生成文本。prometheus为true时生成Prometheus的文本格式，否则生成便于阅读的格式，
+    // connections为当前的连接数
+    static std::string render(bool prometheus, int connections);
+
+private:
+    static void add(std::atomic<unsigned long> &a, unsigned long n)
+    {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static shard *local()
+    {
+        static thread_local shard *s = NULL;
+        if (!s)
+        {
+            s = attach();
+        }
+        return s;
+    }
+
+    // 为当前线程分配并登记分片
+    static shard *attach();
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <string.h>
+#include <strings.h>
+#include "mime_types.h"
+
+struct mime_entry
+{
+    const char *ext; // 小写的扩展名，不含"."
+    int len;
+    mime_type mime;
+};
+
+// 常见的类型排在前面，查找时顺序比较
+static const mime_entry mime_table[] = {
+    {"html", 4, {"text/html; charset=utf-8", true}},
+    {"css", 3, {"text/css; charset=utf-8", true}},
+    {"js", 2, {"text/javascript; charset=utf-8", true}},
+    {"png", 3, {"image/png", false}},
+    {"jpg", 3, {"image/jpeg", false}},
+    {"jpeg", 4, {"image/jpeg", false}},
+    {"gif", 3, {"image/gif", false}},
+    {"webp", 4, {"image/webp", false}},
+    {"avif", 4, {"image/avif", false}},
+    {"svg", 3, {"image/svg+xml", true}},
+    {"ico", 3, {"image/x-icon", true}},
+    {"json", 4, {"application/json", true}},
+    {"htm", 3, {"text/html; charset=utf-8", true}},
+    {"mjs", 3, {"text/javascript; charset=utf-8", true}},
+    {"txt", 3, {"text/plain; charset=utf-8", true}},
+    {"xml", 3, {"application/xml", true}},
+    {"map", 3, {"application/json", true}},
+    {"wasm", 4, {"application/wasm", true}},
+    {"woff", 4, {"font/woff", false}},
+    {"woff2", 5, {"font/woff2", false}},
+    {"ttf", 3, {"font/ttf", true}},
+    {"otf", 3, {"font/otf", true}},
+    {"pdf", 3, {"application/pdf", false}},
+    {"mp4", 3, {"video/mp4", false}},
+    {"webm", 4, {"video/webm", false}},
+    {"mp3", 3, {"audio/mpeg", false}},
+    {"ogg", 3, {"audio/ogg", false}},
+    {"zip", 3, {"application/zip", false}},
+    {"gz", 2, {"application/gzip", false}},
+};
+
+static const mime_type default_mime = {"application/octet-stream", false};
+
+const mime_type &lookup_mime(const char *path, int len)
+{
+    // 扩展名是最后一个"/"之后、最后一个"."之后的部分
+    const char *end = path + len;
+    const char *dot = end;
+    while (dot > path && dot[-1] != '.' && dot[-1] != '/')
+    {
+        --dot;
+    }
+    if (dot == path || dot[-1] != '.')
+    {
+        return default_mime;
+    }
+    int ext_len = end - dot;
+    for (size_t i = 0; i < sizeof(mime_table) / sizeof(mime_table[0]); ++i)
+    {
+        if (mime_table[i].len == ext_len && strncasecmp(dot, mime_table[i].ext, ext_len) == 0)
+        {
+            return mime_table[i].mime;
+        }
+    }
+    return default_mime;
+}
@@ -0,0 +1,16 @@
+#ifndef MIME_TYPES_H
+#define MIME_TYPES_H
+
+// 按扩展名确定响应的Content-Type，以及这种内容是否值得压缩。
+// 图片、音视频、字体(woff/woff2)和压缩包本身已经压缩过，再压缩只会浪费CPU
+
+struct mime_type
+{
+    const char *type;  // Content-Type的值
+    bool compressible; // 文本类的内容，gzip/br能显著减小体积
+};
+
+// 按URL或路径(长度为len，不需要以\0结尾)的扩展名查找，扩展名不区分大小写，未知的扩展名是application/octet-stream
+const mime_type &lookup_mime(const char *path, int len);
+
+#endif
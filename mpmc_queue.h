@@ -0,0 +1,152 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// 有界的无锁多生产者多消费者环形队列(Dmitry Vyukov的算法)。
+// 每个槽位带一个序号，生产者和消费者各自用CAS抢占位置，再通过槽位序号交接数据，
+// 入队和出队都不需要加锁，也不需要为每个元素分配内存。
+// 入队位置和出队位置分别放在独立的缓存行中，避免生产者和消费者互相使对方的缓存行失效。
+template <typename T>
+class mpmc_queue
+{
+public:
+    // 容量向上取整到2的幂
+    explicit mpmc_queue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells = new cell[size];
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue()
+    {
+        delete[] m_cells;
+    }
+
+    // 入队，队列满时返回false
+    bool push(const T &data)
+    {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                // 槽位空闲，抢占这个位置
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // 槽位还没有被消费者取走，队列满了
+                return false;
+            }
+            else
+            {
+                // 其他生产者已经抢先用了这个位置
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = data;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 出队，队列空时返回false
+    bool pop(T &data)
+    {
+        return pop_batch(&data, 1) == 1;
+    }
+
+    // 一次取出最多max个连续的元素，只需要一次CAS，返回取出的个数，队列空时返回0
+    size_t pop_batch(T *out, size_t max)
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            // 从pos开始数出已经写好的连续槽位
+            size_t n = 0;
+            while (n < max)
+            {
+                size_t seq = m_cells[(pos + n) & m_mask].seq.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)(pos + n + 1) != 0)
+                {
+                    break;
+                }
+                ++n;
+            }
+
+            if (n == 0)
+            {
+                size_t seq = m_cells[pos & m_mask].seq.load(std::memory_order_acquire);
+                if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+                {
+                    // 槽位还没有被写入，队列空了
+                    return 0;
+                }
+                // 其他消费者已经取走了这个位置
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    cell &c = m_cells[(pos + i) & m_mask];
+                    out[i] = c.data;
+                    // 把槽位交还给绕一圈之后的生产者
+                    c.seq.store(pos + i + m_mask + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    // 队列中元素个数的近似值，并发修改时不精确
+    size_t size_approx() const
+    {
+        size_t enq = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t deq = m_dequeue_pos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+private:
+    static const size_t CACHELINE_SIZE = 64;
+
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    mpmc_queue(const mpmc_queue &);
+    mpmc_queue &operator=(const mpmc_queue &);
+
+private:
+    alignas(CACHELINE_SIZE) cell *m_cells;
+    size_t m_mask;
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+    char m_pad[CACHELINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+#endif
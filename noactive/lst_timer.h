@@ -130,7 +130,11 @@ public:
             return;
         }
         printf( "timer tick\n" );
-        time_t cur = time( NULL );  // 获取当前系统时间
+        tick( time( NULL ) );  // 获取当前系统时间
+    }
+
+    // 以cur作为当前时间处理到期任务，基准测试用它注入模拟的时钟
+    void tick( time_t cur ) {
         util_timer* tmp = head;
         // 从头节点开始依次处理每个定时器，直到遇到一个尚未到期的定时器
         while( tmp ) {
@@ -12,14 +12,26 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <pthread.h>
-#include "lst_timer.h"
+#include <time.h>
+#include "../timing_wheel.h"
 
 #define FD_LIMIT 65535
 #define MAX_EVENT_NUMBER 1024
 #define TIMESLOT 5
+#define BUFFER_SIZE 64
+
+// 用户数据结构
+struct client_data
+{
+    sockaddr_in address;    // 客户端socket地址
+    int sockfd;             // socket文件描述符
+    char buf[ BUFFER_SIZE ];    // 读缓存
+    wheel_timer timer;          // 定时器，嵌入在用户数据中，不再单独new
+};
 
 static int pipefd[2];
-static sort_timer_lst timer_lst;
+// 时间轮以秒为tick
+static timing_wheel timer_wheel( time( NULL ) );
 static int epollfd = 0;
 
 int setnonblocking( int fd )
@@ -57,10 +69,12 @@ void addsig( int sig )
     assert( sigaction( sig, &sa, NULL ) != -1 );
 }
 
+void on_expire( wheel_timer* timer );
+
 void timer_handler()
 {
-    // 定时处理任务，实际上就是调用tick()函数
-    timer_lst.tick();
+    // 定时处理任务，推进时间轮，处理到期的定时器
+    timer_wheel.advance( time( NULL ), on_expire );
     // 因为一次 alarm 调用只会引起一次SIGALARM 信号，所以我们要重新定时，以不断触发 SIGALARM信号。
     alarm(TIMESLOT);
 }
@@ -74,6 +88,11 @@ void cb_func( client_data* user_data )
     printf( "close fd %d\n", user_data->sockfd );
 }
 
+void on_expire( wheel_timer* timer )
+{
+    cb_func( ( client_data* )timer->data );
+}
+
 int main( int argc, char* argv[] ) {
     if( argc <= 1 ) {
         printf( "usage: %s port_number\n", basename( argv[0] ) );
@@ -136,14 +155,10 @@ int main( int argc, char* argv[] ) {
                 users[connfd].address = client_address;
                 users[connfd].sockfd = connfd;
                 
-                // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表timer_lst中
-                util_timer* timer = new util_timer;
-                timer->user_data = &users[connfd];
-                timer->cb_func = cb_func;
+                // 绑定定时器与用户数据，设置超时时间，然后将定时器添加到时间轮中
+                users[connfd].timer.data = &users[connfd];
                 time_t cur = time( NULL );
-                timer->expire = cur + 3 * TIMESLOT;
-                users[connfd].timer = timer;
-                timer_lst.add_timer( timer );
+                timer_wheel.add( &users[connfd].timer, cur + 3 * TIMESLOT );
             } else if( ( sockfd == pipefd[0] ) && ( events[i].events & EPOLLIN ) ) {
                 // 处理信号
                 int sig;
@@ -176,37 +191,28 @@ int main( int argc, char* argv[] ) {
                 memset( users[sockfd].buf, '\0', BUFFER_SIZE );
                 ret = recv( sockfd, users[sockfd].buf, BUFFER_SIZE-1, 0 );
                 printf( "get %d bytes of client data %s from %d\n", ret, users[sockfd].buf, sockfd );
-                util_timer* timer = users[sockfd].timer;
+                wheel_timer* timer = &users[sockfd].timer;
                 if( ret < 0 )
                 {
                     // 如果发生读错误，则关闭连接，并移除其对应的定时器
                     if( errno != EAGAIN )
                     {
                         cb_func( &users[sockfd] );
-                        if( timer )
-                        {
-                            timer_lst.del_timer( timer );
-                        }
+                        timer_wheel.del( timer );
                     }
                 }
                 else if( ret == 0 )
                 {
                     // 如果对方已经关闭连接，则我们也关闭连接，并移除对应的定时器。
                     cb_func( &users[sockfd] );
-                    if( timer )
-                    {
-                        timer_lst.del_timer( timer );
-                    }
+                    timer_wheel.del( timer );
                 }
                 else
                 {
                     // 如果某个客户端上有数据可读，则我们要调整该连接对应的定时器，以延迟该连接被关闭的时间。
-                    if( timer ) {
-                        time_t cur = time( NULL );
-                        timer->expire = cur + 3 * TIMESLOT;
-                        printf( "adjust timer once\n" );
-                        timer_lst.adjust_timer( timer );
-                    }
+                    time_t cur = time( NULL );
+                    printf( "adjust timer once\n" );
+                    timer_wheel.adjust( timer, cur + 3 * TIMESLOT );
                 }
             }
            
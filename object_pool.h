@@ -0,0 +1,48 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <new>
+#include "mpmc_queue.h"
+
+// 多线程共享的对象池。归还的对象放在无锁队列中，取对象时队列为空才新建，
+// 归还时队列已满就直接释放，所以池中最多缓存max_cached个空闲对象。
+// 对象被归还后不会析构，取出的对象保持上次使用后的状态，由使用者负责重置
+template <typename T>
+class object_pool
+{
+public:
+    explicit object_pool(int max_cached) : m_free(max_cached) {}
+
+    ~object_pool()
+    {
+        T *obj;
+        while (m_free.pop(obj))
+        {
+            delete obj;
+        }
+    }
+
+    // 取一个对象，内存不足时返回NULL
+    T *get()
+    {
+        T *obj;
+        if (m_free.pop(obj))
+        {
+            return obj;
+        }
+        return new (std::nothrow) T;
+    }
+
+    void put(T *obj)
+    {
+        if (!m_free.push(obj))
+        {
+            delete obj;
+        }
+    }
+
+private:
+    mpmc_queue<T *> m_free;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include "read_buffer.h"
+#include <string.h>
+#include <new>
+
+slab_pool::slab_pool(int max_cached) : m_free(max_cached)
+{
+}
+
+slab_pool::~slab_pool()
+{
+    char *slab;
+    while (m_free.pop(slab))
+    {
+        delete[] slab;
+    }
+}
+
+char *slab_pool::get()
+{
+    char *slab;
+    if (m_free.pop(slab))
+    {
+        return slab;
+    }
+    return new (std::nothrow) char[SLAB_SIZE];
+}
+
+void slab_pool::put(char *slab)
+{
+    // 池中缓存的slab已经够多了
+    if (!m_free.push(slab))
+    {
+        delete[] slab;
+    }
+}
+
+read_buffer::read_buffer() : m_pool(NULL), m_count(1)
+{
+    m_chunks[0].data = m_inline;
+    m_chunks[0].cap = INLINE_SIZE;
+    m_chunks[0].begin = m_chunks[0].end = m_chunks[0].start = 0;
+}
+
+read_buffer::~read_buffer()
+{
+    clear();
+}
+
+void read_buffer::release(chunk &c)
+{
+    if (c.data != m_inline)
+    {
+        m_pool->put(c.data);
+    }
+}
+
+void read_buffer::clear()
+{
+    for (int i = 0; i < m_count; ++i)
+    {
+        release(m_chunks[i]);
+    }
+    m_chunks[0].data = m_inline;
+    m_chunks[0].cap = INLINE_SIZE;
+    m_chunks[0].begin = m_chunks[0].end = m_chunks[0].start = 0;
+    m_count = 1;
+}
+
+int read_buffer::room() const
+{
+    const chunk &c = m_chunks[m_count - 1];
+    int left = c.cap - c.end + (c.begin == c.end ? c.begin : 0);
+    return m_pool ? left + (MAX_CHUNKS - m_count) * slab_pool::SLAB_SIZE : left;
+}
+
+char *read_buffer::prepare(int *len)
+{
+    chunk *c = &m_chunks[m_count - 1];
+    if (c->begin == c->end)
+    {
+        // 数据已经全部被挪走的块从头开始使用
+        c->begin = c->end = 0;
+    }
+    if (c->end == c->cap)
+    {
+        char *slab = (m_pool && m_count < MAX_CHUNKS) ? m_pool->get() : NULL;
+        if (!slab)
+        {
+            return NULL;
+        }
+        int start = size();
+        c = &m_chunks[m_count++];
+        c->data = slab;
+        c->cap = slab_pool::SLAB_SIZE;
+        c->begin = c->end = 0;
+        c->start = start;
+    }
+    *len = c->cap - c->end;
+    return c->data + c->end;
+}
+
+bool read_buffer::append(const char *data, int len)
+{
+    while (len > 0)
+    {
+        int room;
+        char *p = prepare(&room);
+        if (!p)
+        {
+            return false;
+        }
+        int n = len < room ? len : room;
+        memcpy(p, data, n);
+        commit(n);
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+int read_buffer::find(int off) const
+{
+    for (int i = 0; i < m_count; ++i)
+    {
+        const chunk &c = m_chunks[i];
+        if (off >= c.start && off < c.start + c.end - c.begin)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *read_buffer::at_slow(int off) const
+{
+    int k = find(off);
+    if (k < 0)
+    {
+        return NULL;
+    }
+    const chunk &c = m_chunks[k];
+    return c.data + c.begin + (off - c.start);
+}
+
+int read_buffer::scan(int *pos, scan_line *lines, int max)
+{
+    while (true)
+    {
+        int k = find(*pos);
+        if (k < 0)
+        {
+            return 0;
+        }
+        const chunk &c = m_chunks[k];
+        int local = *pos - c.start;
+        int n = scan_lines(c.data + c.begin, &local, c.end - c.begin, lines, max);
+        *pos = c.start + local;
+        if (n > 0)
+        {
+            // 块内的位置换算成逻辑偏移量
+            for (int i = 0; i < n; ++i)
+            {
+                lines[i].end += c.start;
+                if (lines[i].colon >= 0)
+                {
+                    lines[i].colon += c.start;
+                }
+            }
+            return n;
+        }
+
+        // 块中剩下的数据是一行的开头，这一行在后面的块中结束时把它挪到一起再扫描
+        int ret = join_line(k, *pos);
+        if (ret <= 0)
+        {
+            return ret;
+        }
+    }
+}
+
+int read_buffer::join_line(int k, int pos)
+{
+    // 块k中pos之后没有'\n'，后面的块中的第一个'\n'就是这一行的结尾
+    int line_end = -1;
+    for (int j = k + 1; j < m_count && line_end < 0; ++j)
+    {
+        const chunk &c = m_chunks[j];
+        const char *p = (const char *)memchr(c.data + c.begin, '\n', c.end - c.begin);
+        if (p)
+        {
+            line_end = c.start + (p - c.data - c.begin);
+        }
+    }
+    if (line_end < 0)
+    {
+        return size() - pos > MAX_LINE ? -1 : 0;
+    }
+
+    int line_len = line_end + 1 - pos;
+    char *slab = (line_len <= MAX_LINE && m_count < MAX_CHUNKS && m_pool) ? m_pool->get() : NULL;
+    if (!slab)
+    {
+        return -1;
+    }
+
+    // 块k截断到这一行的开头，后面的块去掉这一行的部分，逻辑偏移量都保持不变
+    int copied = 0;
+    for (int j = k; j < m_count && copied < line_len; ++j)
+    {
+        chunk &c = m_chunks[j];
+        int from = pos + copied - c.start;
+        int len = c.end - c.begin - from;
+        if (len > line_len - copied)
+        {
+            len = line_len - copied;
+        }
+        if (len <= 0)
+        {
+            continue;
+        }
+        memcpy(slab + copied, c.data + c.begin + from, len);
+        copied += len;
+        if (j == k)
+        {
+            c.end = c.begin + from;
+        }
+        else
+        {
+            c.begin += len;
+            c.start += len;
+        }
+    }
+
+    // 新的块插在块k之后
+    memmove(m_chunks + k + 2, m_chunks + k + 1, (m_count - k - 1) * sizeof(chunk));
+    ++m_count;
+    chunk &c = m_chunks[k + 1];
+    c.data = slab;
+    c.cap = slab_pool::SLAB_SIZE;
+    c.begin = 0;
+    c.end = line_len;
+    c.start = pos;
+    return 1;
+}
+
+void read_buffer::consume(int n)
+{
+    int left = size() - n;
+    if (left <= INLINE_SIZE)
+    {
+        // 剩下的数据按顺序搬回内嵌的块。内嵌的块只可能是第一个块，目标不会在源的后面
+        int copied = 0;
+        for (int i = 0; i < m_count; ++i)
+        {
+            chunk &c = m_chunks[i];
+            int len = c.end - c.begin;
+            int from = n > c.start ? n - c.start : 0;
+            if (from < len)
+            {
+                memmove(m_inline + copied, c.data + c.begin + from, len - from);
+                copied += len - from;
+            }
+            release(c);
+        }
+        m_chunks[0].data = m_inline;
+        m_chunks[0].cap = INLINE_SIZE;
+        m_chunks[0].begin = m_chunks[0].start = 0;
+        m_chunks[0].end = copied;
+        m_count = 1;
+        return;
+    }
+
+    // 归还已经全部处理完的块，其余的块偏移量前移n
+    int kept = 0;
+    for (int i = 0; i < m_count; ++i)
+    {
+        chunk c = m_chunks[i];
+        if (c.start + c.end - c.begin <= n)
+        {
+            release(c);
+            continue;
+        }
+        if (c.start < n)
+        {
+            c.begin += n - c.start;
+            c.start = n;
+        }
+        c.start -= n;
+        m_chunks[kept++] = c;
+    }
+    m_count = kept;
+}
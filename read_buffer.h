@@ -0,0 +1,112 @@
+#ifndef READ_BUFFER_H
+#define READ_BUFFER_H
+
+#include "mpmc_queue.h"
+#include "http_scan.h"
+
+// 所有连接共享的固定大小内存块(slab)池。
+// 空闲的slab放在无锁队列中，队列为空时新分配，队列满时直接释放，池中最多缓存max_cached个空闲slab
+class slab_pool
+{
+public:
+    static const int SLAB_SIZE = 8192;
+
+    explicit slab_pool(int max_cached);
+    ~slab_pool();
+
+    // 取一个slab，内存不足时返回NULL
+    char *get();
+    // 归还slab
+    void put(char *slab);
+
+private:
+    mpmc_queue<char *> m_free;
+};
+
+// 链式读缓冲区。连接开始时只使用内嵌的小块，放不下时再从slab池中借用新的块接在后面，
+// 请求处理完之后把借用的块还回池中，大多数连接只占用内嵌的部分。
+// 缓冲区中的位置都是从第一个字节开始的逻辑偏移量，各个块依次覆盖连续的一段。
+// 一行数据被块的边界截断时，scan()把这一行挪到一个新借用的块中，保证每一行在内存中是连续的，
+// 解析器因此仍然可以用指针和长度访问一行中的内容，记录的偏移量也不会因此改变
+class read_buffer
+{
+public:
+    static const int INLINE_SIZE = 1024;
+    static const int MAX_CHUNKS = 16;                 // 包括内嵌的块
+    static const int MAX_LINE = slab_pool::SLAB_SIZE; // 一行(包括\r\n)的最大长度
+    static const int MAX_SIZE = INLINE_SIZE + (MAX_CHUNKS - 1) * slab_pool::SLAB_SIZE; // 缓冲区的最大容量
+
+    read_buffer();
+    ~read_buffer();
+
+    void set_pool(slab_pool *pool) { m_pool = pool; }
+
+    // 已经读入的字节数
+    int size() const
+    {
+        const chunk &c = m_chunks[m_count - 1];
+        return c.start + c.end - c.begin;
+    }
+
+    // 最多还能读入的字节数
+    int room() const;
+
+    // 准备写入：返回最后一个块的空闲空间，*len为其长度，最后一个块已满时先借用一个新的块。
+    // 块数已达上限或者借不到块时返回NULL
+    char *prepare(int *len);
+    // prepare()返回的空间中写入了len字节
+    void commit(int len) { m_chunks[m_count - 1].end += len; }
+    // 拷贝追加，放不下时返回false
+    bool append(const char *data, int len);
+
+    // 偏移量off处的地址，off不在缓冲区中时返回NULL
+    const char *at(int off) const
+    {
+        // 绝大多数请求只在第一个块中
+        const chunk &c = m_chunks[0];
+        if (off >= c.start && off < c.start + c.end - c.begin)
+        {
+            return c.data + c.begin + (off - c.start);
+        }
+        return at_slow(off);
+    }
+
+    // 用扫描器从*pos开始找出完整的行，返回值和*pos的含义与scan_lines相同，行的位置是逻辑偏移量。
+    // 从*pos开始的一行跨越了块的边界时，先把它挪到新的块中再扫描；这一行超过MAX_LINE或者借不到块时返回-1
+    int scan(int *pos, scan_line *lines, int max);
+
+    // 丢弃前n个字节，剩下数据的偏移量从0开始。剩下的数据放得下时搬回内嵌的块，并归还借用的块
+    void consume(int n);
+
+    // 清空缓冲区，归还借用的块
+    void clear();
+
+private:
+    struct chunk
+    {
+        char *data; // 块的内存，内嵌的块指向m_inline
+        int cap;    // 块的大小
+        int begin;  // 有效数据在块中的范围为[begin, end)
+        int end;
+        int start;  // 有效数据第一个字节的逻辑偏移量
+    };
+
+    const char *at_slow(int off) const;
+    // 包含off的块的下标，没有时返回-1
+    int find(int off) const;
+    // 把从块k中pos处开始、在后面的块中结束的一行挪到新的块中，放在块k之后。
+    // 成功返回1，这一行还不完整返回0，出错返回-1
+    int join_line(int k, int pos);
+    void release(chunk &c);
+
+    // 禁止拷贝，块中可能有借来的slab
+    read_buffer(const read_buffer &);
+    read_buffer &operator=(const read_buffer &);
+
+    slab_pool *m_pool;
+    chunk m_chunks[MAX_CHUNKS];
+    int m_count;
+    char m_inline[INLINE_SIZE];
+};
+
+#endif
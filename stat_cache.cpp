@@ -0,0 +1,264 @@
+#include "stat_cache.h"
+#include "log.h"
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+// 会让缓存项失效的事件
+static const unsigned WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+stat_cache::stat_cache(const char *doc_root, size_t capacity)
+    : m_doc_root(doc_root), m_generation(0), m_disabled(false), m_inotify_fd(-1)
+{
+    m_shard_capacity = (capacity + SHARD_NUM - 1) / SHARD_NUM;
+    m_negative_capacity = m_shard_capacity / 4 > 0 ? m_shard_capacity / 4 : 1;
+}
+
+stat_cache::~stat_cache()
+{
+    if (m_inotify_fd >= 0)
+    {
+        close(m_inotify_fd);
+    }
+}
+
+bool stat_cache::start()
+{
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd < 0)
+    {
+        return false;
+    }
+    add_watch("");
+    if (m_watches.empty())
+    {
+        return false;
+    }
+
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        return false;
+    }
+    pthread_detach(m_thread);
+    return true;
+}
+
+// inotify事件给出的是目录加文件名，只有这种规范的写法才能被失效。
+// //f、/./f、/d/../f、/f/等写法以及带有\0的URL指向同一个文件(或者stat时被截断)，但缓存项永远不会失效
+static bool canonical(const char *url, int len)
+{
+    if (len == 0 || url[0] != '/' || memchr(url, '\0', len))
+    {
+        return false;
+    }
+    const char *end = url + len;
+    const char *seg = url + 1;
+    while (true)
+    {
+        const char *slash = (const char *)memchr(seg, '/', end - seg);
+        const char *seg_end = slash ? slash : end;
+        int n = seg_end - seg;
+        if (n == 0 || (n == 1 && seg[0] == '.') || (n == 2 && seg[0] == '.' && seg[1] == '.'))
+        {
+            return false;
+        }
+        if (!slash)
+        {
+            return true;
+        }
+        seg = slash + 1;
+    }
+}
+
+stat_cache::shard &stat_cache::shard_of(const std::string &url)
+{
+    return m_shards[std::hash<std::string>()(url) % SHARD_NUM];
+}
+
+bool stat_cache::lookup(const char *url, int len, char *real_file, struct stat *st, int *verdict, file_validators *v)
+{
+    if (m_disabled.load(std::memory_order_relaxed) || !canonical(url, len))
+    {
+        return false;
+    }
+    std::string key(url, len);
+    shard &s = shard_of(key);
+    s.lock.rdlock();
+    std::unordered_map<std::string, entry>::const_iterator it = s.entries.find(key);
+    if (it == s.entries.end())
+    {
+        it = s.negatives.find(key);
+    }
+    bool hit = it != s.entries.end() && it != s.negatives.end();
+    if (hit)
+    {
+        const entry &e = it->second;
+        memcpy(real_file, e.real_file.c_str(), e.real_file.size() + 1);
+        *st = e.st;
+        *verdict = e.verdict;
+        *v = e.validators;
+    }
+    s.lock.unlock();
+    return hit;
+}
+
+void stat_cache::insert(const char *url, int len, const char *real_file, const struct stat *st, int verdict, bool found,
+                        const file_validators *v, unsigned long generation)
+{
+    if (!canonical(url, len))
+    {
+        return;
+    }
+    std::string key(url, len);
+    shard &s = shard_of(key);
+    s.lock.wrlock();
+    // 在加锁之后比较代数，失效操作也在写锁内修改代数，所以不会漏掉；
+    // 停用标志在清空缓存加锁之前设置，这里也一定能看到
+    if (generation == m_generation.load(std::memory_order_acquire) && !m_disabled.load(std::memory_order_relaxed))
+    {
+        // 同一个URL的判定结果可能从一张表换到另一张表
+        std::unordered_map<std::string, entry> &table = found ? s.entries : s.negatives;
+        (found ? s.negatives : s.entries).erase(key);
+        size_t capacity = found ? m_shard_capacity : m_negative_capacity;
+        if (table.size() >= capacity && table.find(key) == table.end())
+        {
+            // 表满了，随便淘汰一项。错误的URL只会挤掉其他错误的URL
+            table.erase(table.begin());
+        }
+        entry &e = table[key];
+        e.real_file = real_file;
+        e.st = *st;
+        e.verdict = verdict;
+        e.validators = *v;
+    }
+    s.lock.unlock();
+}
+
+void stat_cache::invalidate(const std::string &url)
+{
+    shard &s = shard_of(url);
+    s.lock.wrlock();
+    m_generation.fetch_add(1, std::memory_order_acq_rel);
+    s.entries.erase(url);
+    s.negatives.erase(url);
+    s.lock.unlock();
+}
+
+void stat_cache::invalidate_all()
+{
+    for (int i = 0; i < SHARD_NUM; ++i)
+    {
+        m_shards[i].lock.wrlock();
+    }
+    m_generation.fetch_add(1, std::memory_order_acq_rel);
+    for (int i = 0; i < SHARD_NUM; ++i)
+    {
+        m_shards[i].entries.clear();
+        m_shards[i].negatives.clear();
+        m_shards[i].lock.unlock();
+    }
+}
+
+void stat_cache::add_watch(const std::string &dir)
+{
+    std::string path = m_doc_root + dir;
+    int wd = inotify_add_watch(m_inotify_fd, path.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        LOG_WARN("inotify watch %s failed, errno is: %d", path.c_str(), errno);
+        return;
+    }
+    m_watches[wd] = dir;
+
+    DIR *d = opendir(path.c_str());
+    if (!d)
+    {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+        {
+            add_watch(dir + "/" + ent->d_name);
+        }
+    }
+    closedir(d);
+}
+
+void *stat_cache::worker(void *arg)
+{
+    stat_cache *cache = (stat_cache *)arg;
+    cache->run();
+    return cache;
+}
+
+void stat_cache::run()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(m_inotify_fd, buf, sizeof(buf));
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG_ERROR("inotify read failure, errno is: %d, stat cache disabled", errno);
+            // 无法再得知文件变化，停用缓存后再清空，之后不会再有缓存项
+            m_disabled.store(true, std::memory_order_relaxed);
+            invalidate_all();
+            break;
+        }
+
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // 事件队列溢出，丢失了部分事件，只能全部失效
+                invalidate_all();
+                continue;
+            }
+
+            std::map<int, std::string>::iterator it = m_watches.find(ev->wd);
+            if (it == m_watches.end())
+            {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED)
+            {
+                m_watches.erase(it);
+                continue;
+            }
+
+            std::string url = it->second;
+            if (ev->len > 0)
+            {
+                url += "/";
+                url += ev->name;
+            }
+
+            if ((ev->mask & IN_ISDIR) || (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+            {
+                // 目录的变化会影响其下所有的URL
+                invalidate_all();
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    add_watch(url);
+                }
+            }
+            else
+            {
+                invalidate(url);
+            }
+        }
+    }
+}
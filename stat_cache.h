@@ -0,0 +1,82 @@
+#ifndef STAT_CACHE_H
+#define STAT_CACHE_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include "lock.h"
+#include "http_response.h"
+
+// URL到(文件完整路径, stat结果, 访问权限判定, 验证器)的缓存，由所有工作线程共享。
+// 网站根目录通过inotify监视，目录中的文件被修改、删除、创建或改名时，对应的缓存项立即失效，
+// 所以热点请求可以跳过路径拼接和stat系统调用。
+// 只缓存规范的URL(没有//、.和..段，不以/结尾)，其他写法指向同一个文件却对应不上inotify事件，每次都重新stat。
+// 没有可发送文件的判定结果(不存在、没有权限、是目录)放在容量较小的单独的表中，大量不同的错误URL不会挤掉热点文件。
+// inotify出错后无法再得知文件变化，缓存停用
+class stat_cache
+{
+public:
+    // capacity为最多缓存的URL个数
+    stat_cache(const char *doc_root, size_t capacity);
+    ~stat_cache();
+
+    // 为网站根目录及其子目录添加inotify监视，并启动监视线程，失败返回false
+    bool start();
+
+    // 查找长度为len的url，命中时把完整路径、stat结果、判定结果(http_conn::HTTP_CODE)和验证器拷贝出来并返回true
+    bool lookup(const char *url, int len, char *real_file, struct stat *st, int *verdict, file_validators *v);
+
+    // 缓存未命中时，在stat之前取得当前的失效代数，insert时如果期间发生过失效就不再插入，
+    // 以免把已经过期的结果放进缓存。found为false表示没有可以发送的文件
+    unsigned long generation() const { return m_generation.load(std::memory_order_acquire); }
+    void insert(const char *url, int len, const char *real_file, const struct stat *st, int verdict, bool found,
+                const file_validators *v, unsigned long generation);
+
+private:
+    static const int SHARD_NUM = 16;
+
+    struct entry
+    {
+        std::string real_file; // doc_root + url
+        struct stat st;        // stat的结果，文件不存在时无意义
+        int verdict;           // do_request的判定结果
+        file_validators validators; // 由st生成的ETag和Last-Modified，文件可以访问时才有意义
+    };
+
+    struct shard
+    {
+        rwlocker lock;
+        std::unordered_map<std::string, entry> entries;   // 有可以发送的文件的URL
+        std::unordered_map<std::string, entry> negatives; // 其余判定结果
+    };
+
+    shard &shard_of(const std::string &url);
+
+    // 使某个url失效
+    void invalidate(const std::string &url);
+    void invalidate_all();
+
+    // 递归监视目录，dir为相对网站根目录的路径(以"/"开头，根目录为空串)
+    void add_watch(const std::string &dir);
+
+    static void *worker(void *arg);
+    void run();
+
+private:
+    std::string m_doc_root;
+    size_t m_shard_capacity;
+    size_t m_negative_capacity; // 每个分片的negatives最多的项数，是entries的1/4
+    shard m_shards[SHARD_NUM];
+
+    std::atomic<unsigned long> m_generation;
+    std::atomic<bool> m_disabled; // inotify出错，不再查找和插入
+
+    int m_inotify_fd;
+    std::map<int, std::string> m_watches; // 监视描述符到目录的映射，只由监视线程访问
+    pthread_t m_thread;
+};
+
+#endif
@@ -0,0 +1,119 @@
+// Content-Length回归测试：在长连接上发送非法或过大的Content-Length，
+// 服务器应当只回一个400并关闭连接；合法的请求体之后的流水线请求照常响应
+// 编译: g++ -O2 bad_content_length.cpp -o bad_content_length
+// 用法: ./bad_content_length [-h 地址] [-p 端口] [-u URL路径] [-t 超时秒数]
+// 全部通过时返回0
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+static const char *host = "127.0.0.1";
+static int port = 9006;
+static const char *path = "/index.html";
+static int timeout = 3;
+
+// 发送请求，读到对方关闭连接、超时或者读够上限为止，返回收到的全部数据
+static std::string exchange(const std::string &request)
+{
+    std::string reply;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        close(fd);
+        return reply;
+    }
+    struct timeval tv = {timeout, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+
+    // 服务器反复响应同一个请求时数据不会停，读够1MB就不再读
+    char buf[4096];
+    while (reply.size() < 1024 * 1024)
+    {
+        int n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        reply.append(buf, n);
+    }
+    close(fd);
+    return reply;
+}
+
+// 统计回复中的状态行个数
+static int count_responses(const std::string &reply)
+{
+    int count = 0;
+    for (size_t pos = reply.find("HTTP/1.1 "); pos != std::string::npos; pos = reply.find("HTTP/1.1 ", pos + 1))
+    {
+        ++count;
+    }
+    return count;
+}
+
+static bool check(const char *name, const std::string &request, int expect_count, const char *expect_status)
+{
+    std::string reply = exchange(request);
+    int count = count_responses(reply);
+    bool ok = count == expect_count && reply.compare(0, strlen(expect_status), expect_status) == 0;
+    printf("%-4s %-28s responses=%d bytes=%zu\n", ok ? "ok" : "FAIL", name, count, reply.size());
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:u:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'u': path = optarg; break;
+        case 't': timeout = atoi(optarg); break;
+        default:
+            printf("usage: %s [-h host] [-p port] [-u path] [-t timeout]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::string head = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n";
+    static const struct
+    {
+        const char *name;
+        const char *value;
+    } bad[] = {
+        {"wraps to negative", "4294967000"},
+        {"overflows 64 bits", "99999999999999999999999"},
+        {"larger than read buffer", "100000000"},
+        {"negative", "-5"},
+        {"trailing garbage", "12abc"},
+        {"empty", ""},
+    };
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+    {
+        std::string request = head + "Content-Length: " + bad[i].value + "\r\n\r\n";
+        ok = check(bad[i].name, request, 1, "HTTP/1.1 400") && ok;
+    }
+
+    // 合法的请求体之后紧跟一个流水线请求，两个都应当得到200，之后长连接保持到超时
+    std::string request = head + "Content-Length: 5\r\n\r\nhello" + head + "\r\n";
+    ok = check("valid body then pipelined", request, 2, "HTTP/1.1 200") && ok;
+
+    printf("%s\n", ok ? "all passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,495 @@
+// 基准测试驱动：生成一个临时的网站根目录，在本机回环地址上启动服务器，依次运行一组固定的场景，
+// 每个场景输出一行JSON(吞吐量、延迟分位数、每个请求的服务器CPU时间、服务器RSS)，便于比较不同版本的结果。
+// 服务器在子进程中运行，CPU时间和内存只统计服务器本身，不包括发压的开销
+// 编译: g++ -O2 bench_harness.cpp -o bench_harness -pthread
+// 用法: ./bench_harness -s 服务器程序 [-p 端口] [-t 每个场景的秒数] [-T 发压线程数] [-S 场景1,场景2]
+//                       [-I 空闲连接数] [-o 结果文件] [-k] [-- 服务器的其他参数]
+// -k保留生成的网站根目录；不指定-S时运行全部场景
+// 例如: ./bench_harness -s ../a.out -t 10 -o results.jsonl -- -r 2 -i uring
+#include "loadgen.h"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <atomic>
+
+// 每个源地址最多使用的连接数，小于默认的本地端口范围，见idle_rss.cpp
+static const int CONNS_PER_SOURCE = 25000;
+
+// 慢客户端每10毫秒从每个连接读取的字节数，即每个连接约100KB/s
+static const int SLOW_READ_BYTES = 1024;
+
+struct scenario
+{
+    const char *name;
+    load_options load;
+    int slow_clients;     // 同时运行的慢速下载客户端数
+    int idle_connections; // 发压前建立的空闲连接数
+};
+
+// 服务器进程的CPU时间(秒)
+static double server_cpu(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        return 0;
+    }
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // 进程名中可能有空格，从最后一个')'之后开始数，utime和stime是第14、15个字段
+    const char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    {
+        return 0;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// 服务器进程的VmRSS和VmHWM(kB)
+static void server_rss(int pid, long *rss, long *hwm)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    *rss = *hwm = 0;
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f))
+    {
+        sscanf(line, "VmRSS: %ld", rss);
+        sscanf(line, "VmHWM: %ld", hwm);
+    }
+    fclose(f);
+}
+
+static bool write_file(const std::string &path, const std::string &data)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f)
+    {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+    return ok;
+}
+
+// 生成网站根目录：小页面和1MB的文件
+static bool make_doc_root(const std::string &root)
+{
+    std::string tiny = "<!DOCTYPE html>\n<html><head><title>bench</title></head>\n<body>\n";
+    while (tiny.size() < 300)
+    {
+        tiny += "<p>keep-alive benchmark page</p>\n";
+    }
+    tiny += "</body></html>\n";
+    std::string big(1 << 20, '\0');
+    unsigned x = 12345;
+    for (size_t i = 0; i < big.size(); ++i)
+    {
+        x = x * 1103515245 + 12345;
+        big[i] = 'a' + (x >> 16) % 26;
+    }
+    return write_file(root + "/index.html", tiny) && write_file(root + "/1m.bin", big);
+}
+
+// 启动服务器，等它开始监听，失败返回-1
+static int start_server(const char *server, int port, const std::string &root, const std::vector<const char *> &extra)
+{
+    std::string port_arg = std::to_string(port);
+    std::vector<const char *> argv;
+    argv.push_back(server);
+    argv.push_back(port_arg.c_str());
+    argv.push_back("-d");
+    argv.push_back(root.c_str());
+    argv.insert(argv.end(), extra.begin(), extra.end());
+    argv.push_back(NULL);
+
+    int pid = fork();
+    if (pid < 0)
+    {
+        return -1;
+    }
+    if (pid == 0)
+    {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv(server, (char *const *)&argv[0]);
+        _exit(127);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 100; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        bool ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(fd);
+        if (ok)
+        {
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            return -1;
+        }
+        usleep(50000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// 建立空闲连接，返回建立的连接。文件描述符上限不够时减少连接数，给发压的连接留出余量
+static std::vector<int> open_idle(int port, int count)
+{
+    static const int RESERVED_FDS = 1024;
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)count + RESERVED_FDS)
+    {
+        rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, count + RESERVED_FDS);
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < (rlim_t)count + RESERVED_FDS)
+        {
+            count = rl.rlim_cur > (rlim_t)RESERVED_FDS ? rl.rlim_cur - RESERVED_FDS : 0;
+            fprintf(stderr, "RLIMIT_NOFILE is %ld, only %d idle connections are opened\n", (long)rl.rlim_cur, count);
+        }
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::vector<int> fds;
+    for (int i = 0; i < count; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            break;
+        }
+        if (i >= CONNS_PER_SOURCE)
+        {
+            // 本地端口不够用，换一个回环地址作为源地址
+            struct sockaddr_in local;
+            memset(&local, 0, sizeof(local));
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(0x7f000001 + i / CONNS_PER_SOURCE);
+            bind(fd, (struct sockaddr *)&local, sizeof(local));
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            close(fd);
+            break;
+        }
+        fds.push_back(fd);
+    }
+    return fds;
+}
+
+// 慢客户端：接收缓冲区很小，每10毫秒每个连接只读一点数据，服务器的发送会长时间阻塞在这些连接上
+struct slow_clients
+{
+    int port;
+    int count;
+    std::atomic<bool> running;
+    std::atomic<unsigned long> bytes;
+    pthread_t tid;
+};
+
+static int open_slow(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int rcvbuf = 4096;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    static const char request[] = "GET /1m.bin HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != (ssize_t)sizeof(request) - 1)
+    {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void *slow_loop(void *arg)
+{
+    slow_clients *s = (slow_clients *)arg;
+    std::vector<int> fds(s->count, -1);
+    char buf[SLOW_READ_BYTES];
+    while (s->running.load())
+    {
+        for (int i = 0; i < s->count; ++i)
+        {
+            if (fds[i] < 0)
+            {
+                fds[i] = open_slow(s->port);
+                continue;
+            }
+            ssize_t n = recv(fds[i], buf, sizeof(buf), 0);
+            if (n > 0)
+            {
+                s->bytes += n;
+            }
+            else if (n == 0 || errno != EAGAIN)
+            {
+                // 服务器关闭了连接(发送超时)，重新连接
+                close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+        usleep(10000);
+    }
+    for (int i = 0; i < s->count; ++i)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    return NULL;
+}
+
+static std::vector<scenario> make_scenarios(int port, double duration, int threads, int idle)
+{
+    load_options base;
+    base.port = port;
+    base.duration = duration;
+    base.threads = threads;
+
+    std::vector<scenario> list;
+    scenario s;
+    s.slow_clients = 0;
+    s.idle_connections = 0;
+
+    // 小文件，长连接，闭环
+    s.name = "tiny-keepalive";
+    s.load = base;
+    s.load.connections = 64;
+    list.push_back(s);
+
+    // 1MB文件的下载
+    s.name = "download-1m";
+    s.load = base;
+    s.load.connections = 16;
+    s.load.path = "/1m.bin";
+    list.push_back(s);
+
+    // 每个请求新建连接
+    s.name = "connection-churn";
+    s.load = base;
+    s.load.connections = 32;
+    s.load.keepalive = false;
+    list.push_back(s);
+
+    // 全部请求不存在的文件
+    s.name = "404-storm";
+    s.load = base;
+    s.load.connections = 64;
+    s.load.path = "/no/such/file.html";
+    list.push_back(s);
+
+    // 慢速下载的客户端占着连接和发送缓冲区时，正常客户端的延迟
+    s.name = "slow-clients";
+    s.load = base;
+    s.load.connections = 16;
+    s.load.rate = 2000;
+    s.slow_clients = 256;
+    list.push_back(s);
+    s.slow_clients = 0;
+
+    // 大量空闲的长连接，加上少量开环的请求
+    s.name = "idle-50k";
+    s.load = base;
+    s.load.connections = 16;
+    s.load.rate = 1000;
+    s.idle_connections = idle;
+    list.push_back(s);
+    return list;
+}
+
+static bool selected(const char *list, const char *name)
+{
+    if (!list)
+    {
+        return true;
+    }
+    int len = strlen(name);
+    for (const char *p = list; (p = strstr(p, name)) != NULL; p += len)
+    {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = NULL;
+    int port = 9106;
+    double duration = 10;
+    int threads = 2;
+    const char *only = NULL;
+    int idle = 50000;
+    const char *output = NULL;
+    bool keep_root = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:t:T:S:I:o:k")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': server = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 't': duration = atof(optarg); break;
+        case 'T': threads = atoi(optarg); break;
+        case 'S': only = optarg; break;
+        case 'I': idle = atoi(optarg); break;
+        case 'o': output = optarg; break;
+        case 'k': keep_root = true; break;
+        default:
+            server = NULL;
+            break;
+        }
+    }
+    if (!server || duration <= 0 || threads <= 0)
+    {
+        printf("usage: %s -s server_binary [-p port] [-t seconds] [-T threads] [-S scenario,...] [-I idle_connections] "
+               "[-o results.jsonl] [-k] [-- server args]\n", argv[0]);
+        return 1;
+    }
+    // "--"之后的参数原样传给服务器
+    std::vector<const char *> extra(argv + optind, argv + argc);
+
+    signal(SIGPIPE, SIG_IGN);
+    FILE *out = output ? fopen(output, "a") : stdout;
+    if (!out)
+    {
+        printf("open %s failed\n", output);
+        return 1;
+    }
+
+    char root_tmpl[] = "/tmp/bench_root.XXXXXX";
+    if (!mkdtemp(root_tmpl) || !make_doc_root(root_tmpl))
+    {
+        printf("create document root failed\n");
+        return 1;
+    }
+    std::string root = root_tmpl;
+
+    std::string server_args;
+    for (size_t i = 0; i < extra.size(); ++i)
+    {
+        server_args += (i ? " " : "") + std::string(extra[i]);
+    }
+
+    int status = 0;
+    std::vector<scenario> list = make_scenarios(port, duration, threads, idle);
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        scenario &s = list[i];
+        if (!selected(only, s.name))
+        {
+            continue;
+        }
+        // 每个场景使用新启动的服务器，互不影响
+        int pid = start_server(server, port, root, extra);
+        if (pid < 0)
+        {
+            fprintf(stderr, "%s: start server failed\n", s.name);
+            status = 1;
+            continue;
+        }
+
+        std::vector<int> idle_fds;
+        if (s.idle_connections > 0)
+        {
+            idle_fds = open_idle(port, s.idle_connections);
+        }
+        slow_clients slow;
+        slow.port = port;
+        slow.count = s.slow_clients;
+        slow.running = true;
+        slow.bytes = 0;
+        if (slow.count > 0)
+        {
+            pthread_create(&slow.tid, NULL, slow_loop, &slow);
+            usleep(200000);
+        }
+
+        double cpu_before = server_cpu(pid);
+        load_result r;
+        run_load(s.load, &r);
+        double cpu = server_cpu(pid) - cpu_before;
+        long rss, hwm;
+        server_rss(pid, &rss, &hwm);
+
+        if (slow.count > 0)
+        {
+            slow.running = false;
+            pthread_join(slow.tid, NULL);
+        }
+        for (size_t k = 0; k < idle_fds.size(); ++k)
+        {
+            close(idle_fds[k]);
+        }
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+
+        unsigned long done = r.ok + r.non_2xx;
+        const latency_hist &h = r.latency;
+        fprintf(out,
+                "{\"scenario\":\"%s\",\"server_args\":\"%s\",\"connections\":%d,\"rate\":%.0f,\"seconds\":%.3f,"
+                "\"requests\":%lu,\"ok\":%lu,\"non_2xx\":%lu,\"errors\":%lu,\"missed\":%lu,\"connects\":%lu,"
+                "\"throughput_rps\":%.1f,\"mb_per_s\":%.2f,"
+                "\"latency_us\":{\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},"
+                "\"server_cpu_us_per_request\":%.2f,\"server_rss_kb\":%ld,\"server_hwm_kb\":%ld,"
+                "\"idle_connections\":%zu,\"slow_clients\":%d,\"slow_bytes\":%lu}\n",
+                s.name, server_args.c_str(), s.load.connections, s.load.rate, r.elapsed, done, r.ok, r.non_2xx,
+                r.errors, r.missed, r.connects, done / r.elapsed, r.bytes / r.elapsed / 1e6, h.mean() / 1e3,
+                h.quantile(0.5) / 1e3, h.quantile(0.9) / 1e3, h.quantile(0.99) / 1e3, h.quantile(0.999) / 1e3,
+                h.max() / 1e3, done ? cpu * 1e6 / done : 0.0, rss, hwm, idle_fds.size(), slow.count,
+                slow.bytes.load());
+        fflush(out);
+        fprintf(stderr, "%-18s %10.0f req/s  p99 %8.1f us  cpu %6.2f us/req  rss %ld kB\n", s.name, done / r.elapsed,
+                h.quantile(0.99) / 1e3, done ? cpu * 1e6 / done : 0.0, rss);
+    }
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    if (!keep_root)
+    {
+        unlink((root + "/index.html").c_str());
+        unlink((root + "/1m.bin").c_str());
+        rmdir(root.c_str());
+    }
+    else
+    {
+        fprintf(stderr, "document root kept in %s\n", root.c_str());
+    }
+    return status;
+}
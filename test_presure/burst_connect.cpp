@@ -0,0 +1,194 @@
+// 连接风暴测试：同时发起大量非阻塞connect，每个连接建立后发送一个GET请求，
+// 统计所有连接从发起到收到完整响应头的时间，用于衡量服务器接受连接的能力
+// 编译: g++ -O2 burst_connect.cpp -o burst_connect
+// 用法: ./burst_connect [-h 地址] [-p 端口] [-c 连接数] [-u URL路径] [-t 超时秒数]
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+struct conn
+{
+    int fd;
+    double start;    // 发起connect的时间
+    double done;     // 收到响应头的时间，未完成为0
+    bool sent;       // 请求是否已经发送
+    char buf[512];   // 只需要找到响应头的结尾
+    int len;
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    int port = 9006;
+    int total = 5000;
+    const char *path = "/index.html";
+    int timeout = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:u:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': total = atoi(optarg); break;
+        case 'u': path = optarg; break;
+        case 't': timeout = atoi(optarg); break;
+        default:
+            printf("usage: %s [-h host] [-p port] [-c connections] [-u path] [-t timeout]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // 连接数可能超过默认的文件描述符上限
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)total + 16)
+    {
+        rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, total + 16);
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+
+    char request[1024];
+    int request_len = snprintf(request, sizeof(request),
+                               "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+
+    int epollfd = epoll_create1(0);
+    std::vector<conn> conns(total);
+    int failed = 0, finished = 0;
+
+    // 一次性发起所有的connect
+    double begin = now();
+    for (int i = 0; i < total; ++i)
+    {
+        conn &c = conns[i];
+        c.done = 0;
+        c.sent = false;
+        c.len = 0;
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        c.start = now();
+        if (c.fd < 0 || (connect(c.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS))
+        {
+            ++failed;
+            if (c.fd >= 0)
+            {
+                close(c.fd);
+            }
+            c.fd = -1;
+            continue;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+        ev.data.u32 = i;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+    double connect_done = now();
+
+    std::vector<epoll_event> events(1024);
+    while (finished + failed < total && now() - begin < timeout)
+    {
+        int n = epoll_wait(epollfd, &events[0], events.size(), 100);
+        for (int i = 0; i < n; ++i)
+        {
+            conn &c = conns[events[i].data.u32];
+            if (c.fd < 0)
+            {
+                continue;
+            }
+            if (!c.sent && (events[i].events & EPOLLOUT))
+            {
+                if (send(c.fd, request, request_len, MSG_NOSIGNAL) != request_len)
+                {
+                    ++failed;
+                    close(c.fd);
+                    c.fd = -1;
+                    continue;
+                }
+                c.sent = true;
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.u32 = events[i].data.u32;
+                epoll_ctl(epollfd, EPOLL_CTL_MOD, c.fd, &ev);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+            {
+                int r = recv(c.fd, c.buf + c.len, sizeof(c.buf) - 1 - c.len, 0);
+                if (r > 0)
+                {
+                    c.len += r;
+                    c.buf[c.len] = '\0';
+                }
+                if (r > 0 && strstr(c.buf, "\r\n\r\n"))
+                {
+                    c.done = now();
+                    ++finished;
+                }
+                else if (r > 0 && c.len < (int)sizeof(c.buf) - 1)
+                {
+                    continue;
+                }
+                else if (r < 0 && errno == EAGAIN)
+                {
+                    continue;
+                }
+                else
+                {
+                    ++failed;
+                }
+                close(c.fd);
+                c.fd = -1;
+            }
+        }
+    }
+    double end = now();
+
+    std::vector<double> latency;
+    for (int i = 0; i < total; ++i)
+    {
+        if (conns[i].done > 0)
+        {
+            latency.push_back((conns[i].done - conns[i].start) * 1000);
+        }
+        else if (conns[i].fd >= 0)
+        {
+            close(conns[i].fd);
+        }
+    }
+    std::sort(latency.begin(), latency.end());
+    int timed_out = total - finished - failed;
+
+    printf("connections=%d ok=%d failed=%d timeout=%d\n", total, finished, failed, timed_out);
+    printf("connect burst %.1f ms, all done in %.1f ms\n", (connect_done - begin) * 1000, (end - begin) * 1000);
+    if (!latency.empty())
+    {
+        size_t n = latency.size();
+        printf("latency ms: p50=%.1f p90=%.1f p99=%.1f max=%.1f\n",
+               latency[n / 2], latency[n * 9 / 10], latency[std::min(n - 1, n * 99 / 100)], latency[n - 1]);
+    }
+    close(epollfd);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/bash
+# 分别以epoll和io_uring后端启动服务器，用webbench压测同一个URL，对比两者的吞吐量
+# 用法: ./compare_backends.sh <服务器程序> [端口] [并发数] [压测秒数] [URL路径] [reactor数]
+# 例如: ./compare_backends.sh ../a.out 9006 1000 10 /index.html 1
+
+SERVER=${1:?usage: $0 server_binary [port] [clients] [seconds] [path] [reactors]}
+PORT=${2:-9006}
+CLIENTS=${3:-1000}
+SECONDS_=${4:-10}
+URL_PATH=${5:-/index.html}
+REACTORS=${6:-1}
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+WEBBENCH=$DIR/webbench-1.5/webbench
+
+run_one() {
+    local backend=$1
+    "$SERVER" "$PORT" -r "$REACTORS" -i "$backend" > /dev/null 2>&1 &
+    local pid=$!
+    sleep 1
+    # webbench默认发送HTTP/1.0请求，这里用-2与keepalive_bench保持一致
+    local result
+    result=$("$WEBBENCH" -2 -c "$CLIENTS" -t "$SECONDS_" "http://127.0.0.1:$PORT$URL_PATH" 2>&1 | grep -E "Speed=|Requests:")
+    kill "$pid"
+    wait "$pid" 2> /dev/null
+    printf "%-6s %s\n" "$backend" "$(echo $result)"
+}
+
+echo "clients=$CLIENTS time=${SECONDS_}s url=$URL_PATH reactors=$REACTORS"
+run_one epoll
+run_one uring
@@ -0,0 +1,291 @@
+// 空闲连接内存测试：分批建立大量长连接，每个连接发送一个keep-alive的GET请求并读完响应后保持空闲，
+// 在连接数达到每一档时读取服务器进程的RSS，计算每个空闲连接占用的内存
+// 编译: g++ -O2 idle_rss.cpp -o idle_rss
+// 用法: ./idle_rss -P 服务器pid [-h 地址] [-p 端口] [-l 10000,50000,100000] [-u URL路径] [-b 每批连接数] [-t 超时秒数]
+// 本机测试超过约28000个连接时，本地端口不够用，会依次绑定127.0.0.1、127.0.0.2……作为源地址。
+// 客户端和服务器的RLIMIT_NOFILE都需要大于最大的连接数(ulimit -n)
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+// 每个源地址最多使用的连接数，小于默认的本地端口范围
+static const int CONNS_PER_SOURCE = 25000;
+
+struct conn
+{
+    int fd;
+    bool sent;
+    bool done;
+    int header_len;  // 已经收到的响应头长度
+    int body_left;   // 还没有收到的响应体字节数，响应头还没有收完时为-1
+    char header[256];
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 读取进程的VmRSS和RssAnon(kB)，失败返回false
+static bool read_rss(int pid, long *rss, long *anon)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        return false;
+    }
+    char line[256];
+    *rss = *anon = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        sscanf(line, "VmRSS: %ld", rss);
+        sscanf(line, "RssAnon: %ld", anon);
+    }
+    fclose(f);
+    return *rss > 0;
+}
+
+// 处理收到的响应数据，响应完整时返回true
+static bool consume_response(conn &c, const char *data, int len)
+{
+    while (len > 0 && c.body_left < 0)
+    {
+        if (c.header_len == (int)sizeof(c.header) - 1)
+        {
+            return false;
+        }
+        c.header[c.header_len++] = *data++;
+        --len;
+        c.header[c.header_len] = '\0';
+        if (c.header_len >= 4 && memcmp(c.header + c.header_len - 4, "\r\n\r\n", 4) == 0)
+        {
+            const char *cl = strstr(c.header, "Content-Length:");
+            c.body_left = cl ? atoi(cl + 15) : 0;
+        }
+    }
+    if (c.body_left >= 0)
+    {
+        c.body_left -= len;
+        if (c.body_left <= 0)
+        {
+            c.done = true;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    int port = 9006;
+    int pid = 0;
+    const char *levels_arg = "10000,50000,100000";
+    const char *path = "/index.html";
+    int batch = 500;
+    int timeout = 30;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:P:l:u:b:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'P': pid = atoi(optarg); break;
+        case 'l': levels_arg = optarg; break;
+        case 'u': path = optarg; break;
+        case 'b': batch = atoi(optarg); break;
+        case 't': timeout = atoi(optarg); break;
+        default:
+            pid = 0;
+            break;
+        }
+    }
+    if (pid <= 0 || batch <= 0)
+    {
+        printf("usage: %s -P server_pid [-h host] [-p port] [-l levels] [-u path] [-b batch] [-t timeout]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<int> levels;
+    for (const char *p = levels_arg; *p;)
+    {
+        levels.push_back(atoi(p));
+        p = strchr(p, ',');
+        if (!p)
+        {
+            break;
+        }
+        ++p;
+    }
+    std::sort(levels.begin(), levels.end());
+    int total = levels.back();
+
+    // 连接数超过默认的文件描述符上限
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)total + 16)
+    {
+        rl.rlim_cur = std::min<rlim_t>(rl.rlim_max, total + 16);
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < (rlim_t)total + 16)
+        {
+            printf("warning: RLIMIT_NOFILE is %ld, levels above it will fail\n", (long)rl.rlim_cur);
+        }
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    bool loopback = strncmp(host, "127.", 4) == 0;
+
+    char request[1024];
+    int request_len = snprintf(request, sizeof(request),
+                               "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", path, host);
+
+    long base_rss, base_anon;
+    if (!read_rss(pid, &base_rss, &base_anon))
+    {
+        printf("cannot read /proc/%d/status\n", pid);
+        return 1;
+    }
+    printf("idle server: VmRSS %ld kB, RssAnon %ld kB\n", base_rss, base_anon);
+    printf("%10s %8s %12s %12s %16s\n", "conns", "failed", "VmRSS kB", "RssAnon kB", "bytes/conn(anon)");
+
+    int epollfd = epoll_create1(0);
+    std::vector<conn> conns(total);
+    std::vector<epoll_event> events(1024);
+    int opened = 0, failed = 0;
+    char scratch[4096];
+
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        int target = levels[l];
+        double begin = now();
+        while (opened < target && now() - begin < timeout)
+        {
+            // 发起一批连接，等这一批都收到响应再开始下一批，避免监听队列溢出
+            int first = opened;
+            int last = std::min(target, opened + batch);
+            int pending = 0;
+            for (int i = first; i < last; ++i)
+            {
+                conn &c = conns[i];
+                memset(&c, 0, sizeof(c));
+                c.body_left = -1;
+                c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+                if (c.fd >= 0 && loopback && i >= CONNS_PER_SOURCE)
+                {
+                    struct sockaddr_in local;
+                    memset(&local, 0, sizeof(local));
+                    local.sin_family = AF_INET;
+                    local.sin_addr.s_addr = htonl(0x7f000001 + i / CONNS_PER_SOURCE);
+                    bind(c.fd, (struct sockaddr *)&local, sizeof(local));
+                }
+                if (c.fd < 0 || (connect(c.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS))
+                {
+                    ++failed;
+                    if (c.fd >= 0)
+                    {
+                        close(c.fd);
+                    }
+                    c.fd = -1;
+                    continue;
+                }
+                struct epoll_event ev;
+                ev.events = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+                ev.data.u32 = i;
+                epoll_ctl(epollfd, EPOLL_CTL_ADD, c.fd, &ev);
+                ++pending;
+            }
+            opened = last;
+
+            while (pending > 0 && now() - begin < timeout)
+            {
+                int n = epoll_wait(epollfd, &events[0], events.size(), 100);
+                for (int k = 0; k < n; ++k)
+                {
+                    conn &c = conns[events[k].data.u32];
+                    if (c.fd < 0 || c.done)
+                    {
+                        continue;
+                    }
+                    bool ok = true;
+                    if (!c.sent && (events[k].events & EPOLLOUT))
+                    {
+                        ok = send(c.fd, request, request_len, MSG_NOSIGNAL) == request_len;
+                        c.sent = true;
+                        struct epoll_event ev;
+                        ev.events = EPOLLIN | EPOLLRDHUP;
+                        ev.data.u32 = events[k].data.u32;
+                        epoll_ctl(epollfd, EPOLL_CTL_MOD, c.fd, &ev);
+                    }
+                    if (ok && (events[k].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)))
+                    {
+                        int r = 1;
+                        while (ok && !c.done && (r = recv(c.fd, scratch, sizeof(scratch), 0)) > 0)
+                        {
+                            ok = consume_response(c, scratch, r);
+                        }
+                        if (!c.done && (r == 0 || (r < 0 && errno != EAGAIN)))
+                        {
+                            ok = false;
+                        }
+                    }
+                    if (!ok)
+                    {
+                        ++failed;
+                        close(c.fd);
+                        c.fd = -1;
+                        --pending;
+                    }
+                    else if (c.done)
+                    {
+                        // 响应已经收完，连接保持空闲，不再关心它的事件
+                        epoll_ctl(epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+                        --pending;
+                    }
+                }
+            }
+        }
+
+        // 等服务器处理完最后一批连接
+        sleep(1);
+        long rss, anon;
+        if (!read_rss(pid, &rss, &anon))
+        {
+            printf("server exited\n");
+            break;
+        }
+        int alive = opened - failed;
+        printf("%10d %8d %12ld %12ld %16.0f\n", alive, failed, rss, anon,
+               alive > 0 ? (anon - base_anon) * 1024.0 / alive : 0.0);
+    }
+
+    for (int i = 0; i < opened; ++i)
+    {
+        if (conns[i].fd >= 0)
+        {
+            close(conns[i].fd);
+        }
+    }
+    close(epollfd);
+    return 0;
+}
@@ -0,0 +1,68 @@
+// 长连接压测：多个线程各自用epoll驱动一组HTTP/1.1长连接，可以流水线发送，可以按固定速率开环发压，
+// 输出吞吐量和延迟的分位数。webbench每个请求新建连接、每个客户端一个进程，只能测出短连接的吞吐量
+// 编译: g++ -O2 keepalive_bench.cpp -o keepalive_bench -pthread
+// 用法: ./keepalive_bench [-h 地址] [-p 端口] [-u URL路径] [-c 连接数] [-T 线程数] [-d 流水线深度]
+//                         [-r 每秒请求数] [-t 压测秒数] [-0] [-C]
+// -r不指定时为闭环压测；-0发送HTTP/1.0请求；-C每个请求使用新的连接
+// 例如: ./keepalive_bench -c 200 -T 4 -d 8 -t 10
+//       ./keepalive_bench -c 200 -T 4 -r 50000 -t 30
+#include "loadgen.h"
+
+int main(int argc, char *argv[])
+{
+    load_options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:u:c:T:d:r:t:0C")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': o.host = optarg; break;
+        case 'p': o.port = atoi(optarg); break;
+        case 'u': o.path = optarg; break;
+        case 'c': o.connections = atoi(optarg); break;
+        case 'T': o.threads = atoi(optarg); break;
+        case 'd': o.depth = atoi(optarg); break;
+        case 'r': o.rate = atof(optarg); break;
+        case 't': o.duration = atof(optarg); break;
+        case '0': o.http10 = true; break;
+        case 'C': o.keepalive = false; break;
+        default:
+            printf("usage: %s [-h host] [-p port] [-u path] [-c connections] [-T threads] [-d depth] "
+                   "[-r requests/s] [-t seconds] [-0] [-C]\n", argv[0]);
+            return 1;
+        }
+    }
+    o.depth = std::max(1, std::min(o.depth, loadgen_detail::MAX_DEPTH));
+    if (!o.keepalive)
+    {
+        o.depth = 1;
+    }
+
+    load_result r;
+    if (!run_load(o, &r))
+    {
+        printf("invalid address or options\n");
+        return 1;
+    }
+
+    unsigned long done = r.ok + r.non_2xx;
+    printf("connections=%d threads=%d depth=%d %s %s\n", o.connections, o.threads, o.depth,
+           o.rate > 0 ? "open-loop" : "closed-loop", o.http10 ? "HTTP/1.0" : "HTTP/1.1");
+    if (o.rate > 0)
+    {
+        printf("target %.0f req/s\n", o.rate);
+    }
+    printf("requests=%lu ok=%lu non-2xx=%lu errors=%lu missed=%lu connects=%lu\n", done, r.ok, r.non_2xx, r.errors,
+           r.missed, r.connects);
+    printf("throughput %.0f req/s, %.2f MB/s in %.2f s\n", done / r.elapsed, r.bytes / r.elapsed / 1e6, r.elapsed);
+    const latency_hist &h = r.latency;
+    printf("latency us: mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", h.mean() / 1e3,
+           h.quantile(0.5) / 1e3, h.quantile(0.9) / 1e3, h.quantile(0.99) / 1e3, h.quantile(0.999) / 1e3,
+           h.max() / 1e3);
+    if (r.missed > 0)
+    {
+        printf("warning: %lu scheduled requests were never sent, the server could not keep up with the target rate\n",
+               r.missed);
+    }
+    return 0;
+}
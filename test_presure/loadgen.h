@@ -0,0 +1,568 @@
+// 长连接压测的发压引擎，由keepalive_bench等工具使用。
+// 每个线程一个epoll循环，负责一部分连接；连接上可以流水线发送多个请求(depth)。
+// 指定总速率时按开环方式发压：每个连接按固定间隔安排请求，延迟从安排的时间算起，
+// 服务器变慢时排队的请求也计入延迟，避免闭环压测的协调遗漏(coordinated omission)；
+// 不指定速率时为闭环，每个连接始终保持depth个未完成的请求，延迟从实际发出算起
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static inline long long loadgen_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 对数-线性分桶的延迟直方图(纳秒)，每个2的幂区间分为32个桶，相对误差不超过1/32
+class latency_hist
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_EXP = 40;
+    static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_BUCKETS;
+
+    latency_hist() : m_buckets(BUCKETS, 0), m_count(0), m_sum(0), m_max(0) {}
+
+    void record(long long ns)
+    {
+        unsigned long v = ns < 0 ? 0 : ns;
+        ++m_buckets[bucket_of(v)];
+        ++m_count;
+        m_sum += v;
+        if (v > m_max)
+        {
+            m_max = v;
+        }
+    }
+
+    void merge(const latency_hist &other)
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            m_buckets[i] += other.m_buckets[i];
+        }
+        m_count += other.m_count;
+        m_sum += other.m_sum;
+        if (other.m_max > m_max)
+        {
+            m_max = other.m_max;
+        }
+    }
+
+    unsigned long count() const { return m_count; }
+    unsigned long max() const { return m_max; }
+    double mean() const { return m_count ? (double)m_sum / m_count : 0; }
+
+    // 第q分位数，取所在桶的中点
+    double quantile(double q) const
+    {
+        if (m_count == 0)
+        {
+            return 0;
+        }
+        unsigned long rank = (unsigned long)(q * m_count);
+        if (rank >= m_count)
+        {
+            rank = m_count - 1;
+        }
+        unsigned long seen = 0;
+        for (int b = 0; b < BUCKETS; ++b)
+        {
+            seen += m_buckets[b];
+            if (seen > rank)
+            {
+                double lo = floor_of(b);
+                double hi = b + 1 < BUCKETS ? floor_of(b + 1) : lo;
+                double mid = (lo + hi) / 2;
+                return mid > m_max ? m_max : mid;
+            }
+        }
+        return m_max;
+    }
+
+private:
+    static int bucket_of(unsigned long v)
+    {
+        if (v < (unsigned long)SUB_BUCKETS)
+        {
+            return v;
+        }
+        int exp = 63 - __builtin_clzl(v);
+        if (exp > MAX_EXP)
+        {
+            return BUCKETS - 1;
+        }
+        return (exp - SUB_BITS + 1) * SUB_BUCKETS + ((v >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    static unsigned long floor_of(int b)
+    {
+        if (b < SUB_BUCKETS)
+        {
+            return b;
+        }
+        int exp = b / SUB_BUCKETS + SUB_BITS - 1;
+        return (unsigned long)(SUB_BUCKETS + b % SUB_BUCKETS) << (exp - SUB_BITS);
+    }
+
+    std::vector<unsigned long> m_buckets;
+    unsigned long m_count;
+    unsigned long m_sum;
+    unsigned long m_max;
+};
+
+struct load_options
+{
+    const char *host = "127.0.0.1";
+    int port = 9006;
+    const char *path = "/index.html";
+    int connections = 100;
+    int threads = 1;
+    int depth = 1;          // 每个连接上最多未完成的请求数，大于1时流水线发送
+    double rate = 0;        // 所有连接合计的每秒请求数，0表示闭环
+    double duration = 10;   // 秒
+    bool http10 = false;    // 发送HTTP/1.0请求
+    bool keepalive = true;  // 为false时每个请求使用新的连接(Connection: close)
+};
+
+struct load_result
+{
+    unsigned long ok = 0;         // 2xx响应数
+    unsigned long non_2xx = 0;    // 其他状态码的响应数
+    unsigned long errors = 0;     // 连接失败或者被关闭时丢失的请求数
+    unsigned long connects = 0;   // 建立的连接数
+    unsigned long bytes = 0;      // 收到的字节数
+    unsigned long missed = 0;     // 开环模式下因为未完成的请求达到depth而到结束时都没有发出的请求数
+    double elapsed = 0;           // 秒
+    latency_hist latency;
+
+    void merge(const load_result &r)
+    {
+        ok += r.ok;
+        non_2xx += r.non_2xx;
+        errors += r.errors;
+        connects += r.connects;
+        bytes += r.bytes;
+        missed += r.missed;
+        latency.merge(r.latency);
+    }
+};
+
+namespace loadgen_detail
+{
+
+static const int MAX_DEPTH = 64;
+static const int RECV_SIZE = 16384;
+
+struct client
+{
+    int fd = -1;
+    int inflight = 0;       // 已经安排(包括还没有发出)的请求数
+    int head = 0;           // intended中最早的请求
+    long out_pending = 0;   // 还没有写入socket的字节数
+    bool want_out = false;  // 是否注册了EPOLLOUT
+    long long next_ns = 0;  // 开环模式下下一个请求安排的时间
+    long long intended[MAX_DEPTH]; // 未完成请求的开始时间，响应按顺序返回
+    // 正在接收的响应
+    bool in_body = false;
+    long body_left = 0;
+    int status = 0;
+    bool server_close = false;
+    int rlen = 0;
+};
+
+struct worker
+{
+    const load_options *opt;
+    struct sockaddr_in addr;
+    std::string batch;      // MAX_DEPTH个请求首尾相连，发送时从中间截取
+    int request_len;
+    long long start_ns, end_ns, interval_ns;
+    int first, count;       // 负责的连接在全部连接中的编号
+    load_result result;
+    pthread_t tid;
+};
+
+static bool open_client(worker *w, int epollfd, client *c)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd < 0)
+    {
+        return false;
+    }
+    if (connect(c->fd, (struct sockaddr *)&w->addr, sizeof(w->addr)) < 0)
+    {
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->want_out = false;
+    c->in_body = false;
+    c->rlen = 0;
+    ++w->result.connects;
+    return true;
+}
+
+// 关闭连接，未完成的请求记为错误。开环模式下保留安排好的时间，下次发送时重新连接
+static void drop_client(worker *w, client *c)
+{
+    if (c->fd >= 0)
+    {
+        close(c->fd);
+        c->fd = -1;
+    }
+    w->result.errors += c->inflight;
+    c->inflight = 0;
+    c->head = 0;
+    c->out_pending = 0;
+}
+
+// 把还没有写出的请求写入socket，失败返回false
+static bool flush_client(worker *w, int epollfd, client *c)
+{
+    while (c->out_pending > 0)
+    {
+        long off = (w->request_len - c->out_pending % w->request_len) % w->request_len;
+        long len = std::min<long>(c->out_pending, (long)w->batch.size() - off);
+        ssize_t n = send(c->fd, w->batch.data() + off, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN)
+            {
+                return false;
+            }
+            break;
+        }
+        c->out_pending -= n;
+    }
+    bool want_out = c->out_pending > 0;
+    if (want_out != c->want_out)
+    {
+        struct epoll_event ev;
+        ev.events = want_out ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_out = want_out;
+    }
+    return true;
+}
+
+// 安排到期的请求并发送
+static void issue(worker *w, int epollfd, client *c, long long now)
+{
+    const load_options &o = *w->opt;
+    int depth = o.depth;
+    int before = c->inflight;
+    if (o.rate > 0)
+    {
+        while (c->next_ns <= now && c->next_ns < w->end_ns && c->inflight < depth)
+        {
+            c->intended[(c->head + c->inflight++) % MAX_DEPTH] = c->next_ns;
+            c->next_ns += w->interval_ns;
+        }
+    }
+    else
+    {
+        while (c->inflight < depth && now < w->end_ns)
+        {
+            c->intended[(c->head + c->inflight++) % MAX_DEPTH] = now;
+        }
+    }
+    if (c->inflight == before && c->out_pending == 0)
+    {
+        return;
+    }
+    if (c->fd < 0 && !open_client(w, epollfd, c))
+    {
+        w->result.errors += c->inflight;
+        c->inflight = 0;
+        c->head = 0;
+        return;
+    }
+    c->out_pending += (long)(c->inflight - before) * w->request_len;
+    if (!flush_client(w, epollfd, c))
+    {
+        drop_client(w, c);
+    }
+}
+
+// 在响应头中查找字段，返回值的起始位置
+static const char *find_header(const char *begin, const char *end, const char *name)
+{
+    int name_len = strlen(name);
+    for (const char *p = begin; p + name_len < end; ++p)
+    {
+        if (p[0] == '\n' && strncasecmp(p + 1, name, name_len) == 0)
+        {
+            p += 1 + name_len;
+            while (p < end && *p == ' ')
+            {
+                ++p;
+            }
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// 读取并解析响应，出错或者连接被关闭返回false
+static bool read_client(worker *w, client *c, char *buf)
+{
+    while (true)
+    {
+        ssize_t n = recv(c->fd, buf + c->rlen, RECV_SIZE - c->rlen, 0);
+        if (n < 0)
+        {
+            return errno == EAGAIN;
+        }
+        if (n == 0)
+        {
+            return false;
+        }
+        w->result.bytes += n;
+        int len = c->rlen + n;
+        int pos = 0;
+        while (pos < len)
+        {
+            if (!c->in_body)
+            {
+                const char *h = buf + pos;
+                const char *hend = (const char *)memmem(h, len - pos, "\r\n\r\n", 4);
+                if (!hend)
+                {
+                    break;
+                }
+                if (c->inflight == 0)
+                {
+                    // 没有请求却收到了响应
+                    return false;
+                }
+                c->status = len - pos > 12 ? atoi(h + 9) : 0;
+                const char *cl = find_header(h, hend + 2, "Content-Length:");
+                c->body_left = cl ? atol(cl) : 0;
+                const char *conn = find_header(h, hend + 2, "Connection:");
+                c->server_close = conn && strncasecmp(conn, "close", 5) == 0;
+                c->in_body = true;
+                pos = hend + 4 - buf;
+            }
+            long take = std::min<long>(c->body_left, len - pos);
+            pos += take;
+            c->body_left -= take;
+            if (c->body_left > 0)
+            {
+                break;
+            }
+            // 一个响应接收完毕
+            c->in_body = false;
+            w->result.latency.record(loadgen_now_ns() - c->intended[c->head]);
+            c->head = (c->head + 1) % MAX_DEPTH;
+            --c->inflight;
+            if (c->status >= 200 && c->status < 300)
+            {
+                ++w->result.ok;
+            }
+            else
+            {
+                ++w->result.non_2xx;
+            }
+            if (c->server_close)
+            {
+                // 服务器要求关闭连接，后面的请求不会再有响应
+                return false;
+            }
+        }
+        c->rlen = len - pos;
+        if (c->rlen == RECV_SIZE)
+        {
+            // 响应头超过了缓冲区
+            return false;
+        }
+        memmove(buf, buf + pos, c->rlen);
+    }
+}
+
+// 一个发压线程，连接上未解析完的响应数据保存在各自的接收缓冲区中
+static void *worker_loop(void *arg)
+{
+    worker *w = (worker *)arg;
+    const load_options &o = *w->opt;
+    std::vector<client> clients(w->count);
+    std::vector<std::vector<char> > bufs(w->count, std::vector<char>(RECV_SIZE));
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    // 开环模式下用timerfd在下一个请求到期时唤醒，epoll_wait的毫秒精度会让请求晚发最多1毫秒
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event tev;
+    tev.events = EPOLLIN;
+    tev.data.ptr = NULL;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &tev);
+
+    // 开环模式下各连接的第一个请求错开安排，避免所有连接同时发送
+    long long stagger = o.rate > 0 ? (long long)(1e9 / o.rate) : 0;
+    for (int i = 0; i < w->count; ++i)
+    {
+        clients[i].next_ns = w->start_ns + (w->first + i) * stagger;
+        if (o.keepalive && !open_client(w, epollfd, &clients[i]))
+        {
+            ++w->result.errors;
+        }
+    }
+
+    std::vector<epoll_event> events(1024);
+    long long last_sweep = 0;
+    long long now = loadgen_now_ns();
+    while (now < w->end_ns)
+    {
+        int n = epoll_wait(epollfd, &events[0], events.size(), 10);
+        now = loadgen_now_ns();
+        for (int i = 0; i < n; ++i)
+        {
+            client *c = (client *)events[i].data.ptr;
+            if (!c)
+            {
+                unsigned long long expirations;
+                ssize_t ret = ::read(timerfd, &expirations, sizeof(expirations));
+                (void)ret;
+                continue;
+            }
+            int idx = c - &clients[0];
+            bool ok = true;
+            if (events[i].events & EPOLLOUT)
+            {
+                ok = flush_client(w, epollfd, c);
+            }
+            if (ok && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+            {
+                ok = read_client(w, c, &bufs[idx][0]);
+            }
+            if (!ok)
+            {
+                drop_client(w, c);
+            }
+            if (o.rate <= 0)
+            {
+                issue(w, epollfd, c, now);
+            }
+        }
+        if (o.rate > 0 || now - last_sweep > 10000000LL)
+        {
+            // 开环模式每次醒来都检查到期的请求，并把定时器设到最早的下一个请求；闭环模式定期重新发起断开的连接
+            long long next = w->end_ns;
+            for (int i = 0; i < w->count; ++i)
+            {
+                issue(w, epollfd, &clients[i], now);
+                if (clients[i].inflight < o.depth && clients[i].next_ns < next)
+                {
+                    next = clients[i].next_ns;
+                }
+            }
+            last_sweep = now;
+            if (o.rate > 0)
+            {
+                struct itimerspec its;
+                memset(&its, 0, sizeof(its));
+                its.it_value.tv_sec = next / 1000000000LL;
+                its.it_value.tv_nsec = next % 1000000000LL;
+                timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+            }
+        }
+    }
+
+    for (int i = 0; i < w->count; ++i)
+    {
+        client &c = clients[i];
+        if (o.rate > 0 && c.next_ns < w->end_ns)
+        {
+            w->result.missed += (w->end_ns - c.next_ns + w->interval_ns - 1) / w->interval_ns;
+        }
+        if (c.fd >= 0)
+        {
+            close(c.fd);
+        }
+    }
+    close(timerfd);
+    close(epollfd);
+    return NULL;
+}
+
+} // namespace loadgen_detail
+
+// 按options发压，返回合并后的结果。地址无效时返回false
+inline bool run_load(const load_options &options, load_result *result)
+{
+    using namespace loadgen_detail;
+    // 每个请求使用新连接时不能流水线
+    load_options o = options;
+    o.depth = o.keepalive ? std::max(1, std::min(o.depth, MAX_DEPTH)) : 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(o.port);
+    if (inet_pton(AF_INET, o.host, &addr.sin_addr) != 1 || o.connections <= 0 || o.threads <= 0)
+    {
+        return false;
+    }
+
+    char request[1024];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.%d\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                               o.path, o.http10 ? 0 : 1, o.host, o.keepalive ? "keep-alive" : "close");
+    std::string batch;
+    for (int i = 0; i < MAX_DEPTH; ++i)
+    {
+        batch.append(request, request_len);
+    }
+
+    int threads = std::min(o.threads, o.connections);
+    std::vector<worker> workers(threads);
+    long long start = loadgen_now_ns();
+    int first = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        worker &w = workers[i];
+        w.opt = &o;
+        w.addr = addr;
+        w.batch = batch;
+        w.request_len = request_len;
+        w.start_ns = start;
+        w.end_ns = start + (long long)(o.duration * 1e9);
+        w.interval_ns = o.rate > 0 ? (long long)(o.connections * 1e9 / o.rate) : 0;
+        w.first = first;
+        w.count = o.connections / threads + (i < o.connections % threads ? 1 : 0);
+        first += w.count;
+        pthread_create(&w.tid, NULL, worker_loop, &w);
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(workers[i].tid, NULL);
+        result->merge(workers[i].result);
+    }
+    result->elapsed = (loadgen_now_ns() - start) / 1e9;
+    return true;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef BENCH_H
+#define BENCH_H
+// 微基准测试的公共工具
+#include <time.h>
+#include <stdio.h>
+
+// 单调时钟，单位纳秒
+static inline double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 阻止编译器把结果优化掉
+template <typename T>
+static inline void do_not_optimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// 打印一行结果: 名称, 操作次数, 总耗时, 每次操作的耗时和每秒操作数
+static inline void report(const char *name, double ops, double elapsed_ns)
+{
+    printf("%-40s %12.0f ops %10.1f ms %8.1f ns/op %8.2f Mops/s\n",
+           name, ops, elapsed_ns / 1e6, elapsed_ns / ops, ops * 1e3 / elapsed_ns);
+}
+
+#endif
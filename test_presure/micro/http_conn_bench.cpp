@@ -0,0 +1,266 @@
+// 请求处理路径的微基准测试：不经过socket，直接驱动真实的http_conn。
+// 每次迭代把一个请求feed()进读缓冲区，调用process_read()解析(包括do_request查找文件)，
+// process_write()生成响应头和iovec，再当作已经全部发出，finish_response()复位连接，和服务器处理长连接请求的路径相同。
+// 同一轮循环中单独给process_write + sent计时，扣除计时本身的开销:
+//   parse : feed + process_read + finish_response，包括借用和归还缓冲区，等于total - write
+//   write : process_write + sent
+//   total : 整个循环每次迭代的耗时
+// 默认使用内置的一组真实客户端发出的请求，也可以指定抓包得到的语料文件(多个请求直接首尾相连，以空行分隔)。
+// 请求中没有Connection: keep-alive时补上这一行，否则finish_response会要求关闭连接。
+// 编译: g++ -O2 http_conn_bench.cpp ../../http_conn.cpp ../../uring.cpp ../../conn_timers.cpp ../../file_registry.cpp
+//           ../../stat_cache.cpp ../../read_buffer.cpp ../../http_scan.cpp ../../http_response.cpp
+//           ../../log.cpp ../../metrics.cpp ../../mime_types.cpp ../../compress_cache.cpp -o http_conn_bench -pthread
+// 用法: ./http_conn_bench [每个请求的迭代次数] [语料文件]
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "../../http_conn.h"
+
+extern const char *doc_root;
+
+// 内置语料：各种客户端发出的请求
+static const char *const CORPUS[][2] = {
+    {"chrome image",
+     "GET /images/image1.jpg HTTP/1.1\r\n"
+     "Host: 192.168.1.10:9006\r\n"
+     "Connection: keep-alive\r\n"
+     "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+     "sec-ch-ua-mobile: ?0\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+     "sec-ch-ua-platform: \"Linux\"\r\n"
+     "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+     "Sec-Fetch-Site: same-origin\r\n"
+     "Sec-Fetch-Mode: no-cors\r\n"
+     "Sec-Fetch-Dest: image\r\n"
+     "Referer: http://192.168.1.10:9006/index.html\r\n"
+     "Accept-Encoding: gzip, deflate, br\r\n"
+     "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+     "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; _ga=GA1.1.1234567890.1697000000\r\n"
+     "\r\n"},
+    {"firefox page",
+     "GET /index.html HTTP/1.1\r\n"
+     "Host: 192.168.1.10:9006\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:119.0) Gecko/20100101 Firefox/119.0\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+     "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+     "Accept-Encoding: gzip, deflate\r\n"
+     "Connection: keep-alive\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "If-Modified-Since: Mon, 02 Oct 2023 08:00:00 GMT\r\n"
+     "\r\n"},
+    {"curl",
+     "GET /index.html HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "User-Agent: curl/7.88.1\r\n"
+     "Accept: */*\r\n"
+     "\r\n"},
+    {"wrk",
+     "GET /index.html HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "\r\n"},
+    {"webbench http/1.0",
+     "GET /index.html HTTP/1.0\r\n"
+     "User-Agent: WebBench 1.5\r\n"
+     "\r\n"},
+    {"revalidate 304",
+     "GET /images/image1.jpg HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "Connection: keep-alive\r\n"
+     "If-Modified-Since: Fri, 01 Jan 2100 00:00:00 GMT\r\n"
+     "\r\n"},
+    {"python 404",
+     "GET /favicon.ico HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "User-Agent: python-requests/2.31.0\r\n"
+     "Accept-Encoding: gzip, deflate\r\n"
+     "Accept: */*\r\n"
+     "Connection: keep-alive\r\n"
+     "\r\n"},
+};
+
+struct request
+{
+    std::string name;
+    std::string data;
+};
+
+// 补上Connection: keep-alive，放在请求行之后
+static std::string ensure_keepalive(const std::string &req)
+{
+    for (size_t p = req.find("\r\n"); p != std::string::npos && p + 2 < req.size(); p = req.find("\r\n", p + 2))
+    {
+        if (strncasecmp(req.c_str() + p + 2, "Connection: keep-alive", 22) == 0)
+        {
+            return req;
+        }
+    }
+    size_t line_end = req.find("\r\n") + 2;
+    return req.substr(0, line_end) + "Connection: keep-alive\r\n" + req.substr(line_end);
+}
+
+// 读取语料文件，按空行切分成请求
+static bool load_corpus(const char *path, std::vector<request> *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return false;
+    }
+    std::string all;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        all.append(buf, n);
+    }
+    fclose(f);
+    size_t start = 0, end;
+    while ((end = all.find("\r\n\r\n", start)) != std::string::npos)
+    {
+        request r;
+        r.data = all.substr(start, end + 4 - start);
+        r.name = r.data.substr(0, std::min(r.data.find("\r\n"), (size_t)36));
+        out->push_back(r);
+        start = end + 4;
+    }
+    return !out->empty();
+}
+
+static bool write_file(const std::string &path, size_t size)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f)
+    {
+        return false;
+    }
+    std::string data(size, 'x');
+    fwrite(data.data(), 1, size, f);
+    fclose(f);
+    return true;
+}
+
+// 一次now_ns()调用的平均耗时
+static double clock_cost()
+{
+    const int n = 1000000;
+    double start = now_ns();
+    double last = start;
+    for (int i = 0; i < n; ++i)
+    {
+        last = now_ns();
+    }
+    return (last - start) / n;
+}
+
+// 对一个请求重复iters次，返回每次迭代的纳秒数，*write_ns为其中生成响应的纳秒数。
+// 每次迭代多调用了两次now_ns()，write区间内包含大约一次调用的耗时，都按clock扣除
+static double run(http_conn &conn, const std::string &req, long iters, double clock, double *write_ns)
+{
+    double write = 0;
+    double start = now_ns();
+    for (long i = 0; i < iters; ++i)
+    {
+        conn.feed(req.data(), req.size());
+        http_conn::HTTP_CODE ret = conn.process_read();
+        double write_start = now_ns();
+        conn.process_write(ret);
+        conn.sent(conn.bytes_left());
+        write += now_ns() - write_start;
+        if (!conn.finish_response())
+        {
+            fprintf(stderr, "connection closed, the request is not a complete keep-alive GET\n");
+            exit(1);
+        }
+    }
+    double total = (now_ns() - start) / iters - 2 * clock;
+    *write_ns = write / iters - clock;
+    return total;
+}
+
+int main(int argc, char *argv[])
+{
+    long iters = argc > 1 ? atol(argv[1]) : 200000;
+
+    std::vector<request> corpus;
+    if (argc > 2)
+    {
+        if (!load_corpus(argv[2], &corpus))
+        {
+            printf("read corpus %s failed\n", argv[2]);
+            return 1;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(CORPUS) / sizeof(CORPUS[0]); ++i)
+        {
+            request r;
+            r.name = CORPUS[i][0];
+            r.data = CORPUS[i][1];
+            corpus.push_back(r);
+        }
+    }
+    for (size_t i = 0; i < corpus.size(); ++i)
+    {
+        corpus[i].data = ensure_keepalive(corpus[i].data);
+    }
+
+    // 临时的网站根目录，文件都小于sendfile的阈值，响应走mmap + writev的路径
+    char root[] = "/tmp/http_conn_bench.XXXXXX";
+    if (!mkdtemp(root) || !write_file(std::string(root) + "/index.html", 350) ||
+        mkdir((std::string(root) + "/images").c_str(), 0755) < 0 ||
+        !write_file(std::string(root) + "/images/image1.jpg", 20000))
+    {
+        printf("create document root failed\n");
+        return 1;
+    }
+    doc_root = root;
+
+    // 和main()一样创建连接共享的对象
+    async_log::init("/dev/null");
+    http_conn::m_slab_pool = new slab_pool(64);
+    http_conn::m_buffer_pool = new object_pool<http_conn::conn_buffers>(16);
+    http_conn::m_file_registry = new file_registry(64 * 1024 * 1024, 1024);
+    stat_cache *cache = new stat_cache(doc_root, 1024);
+    if (cache->start())
+    {
+        http_conn::m_stat_cache = cache;
+    }
+
+    // 连接需要一个真实的文件描述符，但不会在上面收发数据
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    int epollfd = epoll_create1(0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    http_conn *conn = new http_conn;
+    conn->init(sv[0], addr, epollfd, NULL);
+
+    double clock = clock_cost();
+    printf("iterations=%ld stat_cache=%s clock=%.1f ns\n", iters, http_conn::m_stat_cache ? "on" : "off", clock);
+    printf("%-38s %6s %10s %10s %10s %10s\n", "request", "bytes", "parse ns", "write ns", "total ns", "Mreq/s");
+    for (size_t i = 0; i < corpus.size(); ++i)
+    {
+        const std::string &req = corpus[i].data;
+        double write;
+        run(*conn, req, iters / 10 + 1, clock, &write); // 预热：文件映射、stat缓存、缓冲区池
+        double total = run(*conn, req, iters, clock, &write);
+        printf("%-38s %6zu %10.1f %10.1f %10.1f %10.2f\n", corpus[i].name.c_str(), req.size(), total - write, write,
+               total, 1e3 / total);
+    }
+
+    conn->close_conn();
+    close(sv[1]);
+    close(epollfd);
+    unlink((std::string(root) + "/index.html").c_str());
+    unlink((std::string(root) + "/images/image1.jpg").c_str());
+    rmdir((std::string(root) + "/images").c_str());
+    rmdir(root);
+    async_log::stop();
+    return 0;
+}
@@ -0,0 +1,272 @@
+// 连接对象内存布局的微基准测试：对比原来不对齐、字段混排的http_conn布局，
+// 和按缓存行对齐、按访问线程分组的布局在多线程下的伪共享开销。
+// 连接数组中相邻的连接交给不同的线程，每个线程反复处理自己的连接：
+// 一个线程模拟reactor，只读写连接和发送状态；其余线程模拟工作线程，读写解析状态。
+// 用perf_event_open统计所有线程的缓存未命中次数，虚拟机等不支持硬件计数器的环境只输出耗时。
+// 编译: g++ -O2 layout_bench.cpp -o layout_bench -pthread
+// 用法: ./layout_bench [工作线程数] [每个线程的迭代次数]
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <atomic>
+#include "bench.h"
+
+struct span
+{
+    int off;
+    int len;
+};
+
+// 原来的布局：字段按功能零散声明，对象大小200字节，相邻对象共用缓存行
+struct legacy_conn
+{
+    int m_sockfd;
+    sockaddr_in m_address;
+    int m_epollfd;
+    void *m_uring;
+    int m_worker;
+    void *m_buf;
+    int m_checked_idx;
+    int m_start_line;
+    int m_line_start;
+    int m_line_count;
+    int m_line_next;
+    int m_scan_idx;
+    int m_line_colon;
+    int m_line_len;
+    int m_header_count;
+    short m_known[14];
+    int m_check_state;
+    span m_url;
+    span m_version;
+    int m_method;
+    bool m_linger;
+    int m_request_end;
+    int m_content_length;
+    int m_write_idx;
+    int m_file_count;
+    char *m_file_address;
+    int m_file_fd;
+    off_t m_file_offset;
+    int m_iv_count;
+    int m_iv_start;
+    int bytes_to_send;
+    int bytes_have_send;
+};
+
+// 新的布局：对象按缓存行对齐，reactor访问的字段和工作线程访问的字段各占独立的缓存行
+struct aligned_conn
+{
+    alignas(64) int m_sockfd;
+    int m_epollfd;
+    void *m_uring;
+    void *m_buf;
+    int bytes_to_send;
+    int bytes_have_send;
+    int m_iv_count;
+    int m_iv_start;
+    int m_file_fd;
+    off_t m_file_offset;
+    bool m_linger;
+    int m_worker;
+
+    alignas(64) int m_check_state;
+    int m_checked_idx;
+    int m_start_line;
+    int m_line_start;
+    int m_line_count;
+    int m_line_next;
+    int m_scan_idx;
+    int m_line_colon;
+    int m_line_len;
+    int m_method;
+    span m_url;
+    span m_version;
+    int m_content_length;
+    int m_request_end;
+    int m_header_count;
+    short m_known[14];
+    int m_write_idx;
+    int m_file_count;
+    char *m_file_address;
+
+    sockaddr_in m_address;
+};
+
+// reactor处理一次事件：检查连接、准备发送
+template <typename C>
+static inline void reactor_step(C &c)
+{
+    do_not_optimize(c.m_sockfd + c.m_epollfd);
+    do_not_optimize(c.m_buf);
+    c.bytes_have_send += c.bytes_to_send;
+    c.bytes_to_send = c.m_iv_count * 64;
+    c.m_iv_start = c.m_iv_count;
+    c.m_iv_count = (c.m_iv_count + 1) & 7;
+    c.m_file_offset += c.m_file_fd;
+    c.m_linger = !c.m_linger;
+}
+
+// 工作线程解析一行、生成一部分响应
+template <typename C>
+static inline void worker_step(C &c)
+{
+    c.m_check_state = (c.m_check_state + 1) & 3;
+    c.m_start_line = c.m_checked_idx;
+    c.m_line_start = c.m_checked_idx;
+    c.m_checked_idx += 32;
+    c.m_line_next = (c.m_line_next + 1) & 15;
+    c.m_scan_idx = c.m_checked_idx;
+    c.m_line_colon = 8;
+    c.m_line_len = 30;
+    c.m_url.off = c.m_start_line;
+    c.m_known[c.m_line_next & 7] = c.m_header_count;
+    c.m_header_count = (c.m_header_count + 1) & 31;
+    c.m_write_idx += 16;
+    c.m_request_end = c.m_checked_idx;
+    do_not_optimize(c.m_file_address);
+}
+
+template <typename C>
+struct shared_state
+{
+    C *conns;
+    int count;
+    int threads; // 线程总数，线程0是reactor
+    long iters;
+    std::atomic<int> ready;
+};
+
+template <typename C>
+struct thread_arg
+{
+    shared_state<C> *state;
+    int id;
+};
+
+template <typename C>
+static void *run(void *p)
+{
+    thread_arg<C> *arg = (thread_arg<C> *)p;
+    shared_state<C> *s = arg->state;
+    int id = arg->id;
+    // 等所有线程都启动后一起开始
+    s->ready.fetch_add(1);
+    while (s->ready.load() < s->threads)
+    {
+        sched_yield();
+    }
+    // 第i个连接由线程i % threads处理，相邻的连接总是属于不同的线程
+    for (long n = 0; n < s->iters;)
+    {
+        for (int i = id; i < s->count && n < s->iters; i += s->threads, ++n)
+        {
+            if (id == 0)
+            {
+                reactor_step(s->conns[i]);
+            }
+            else
+            {
+                worker_step(s->conns[i]);
+            }
+        }
+    }
+    return NULL;
+}
+
+// 打开统计所有子线程的硬件计数器，不支持时返回-1
+static int open_counter(unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+template <typename C>
+static void bench(const char *name, int workers, long iters)
+{
+    // 每个线程处理64个连接，总大小远小于L2，未命中几乎都来自线程之间的缓存行争用
+    int threads = workers + 1;
+    int count = 64 * threads;
+    C *conns = new C[count];
+    memset((void *)conns, 0, sizeof(C) * count);
+
+    shared_state<C> s;
+    s.conns = conns;
+    s.count = count;
+    s.threads = threads;
+    s.iters = iters;
+    s.ready.store(0);
+
+    // 计数器在创建线程之前打开，inherit使新线程的计数在线程结束时累加进来
+    int misses = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+    int refs = open_counter(PERF_COUNT_HW_CACHE_REFERENCES);
+    if (misses >= 0)
+    {
+        ioctl(misses, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    if (refs >= 0)
+    {
+        ioctl(refs, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    double start = now_ns();
+    pthread_t *tids = new pthread_t[threads];
+    thread_arg<C> *args = new thread_arg<C>[threads];
+    for (int i = 0; i < threads; ++i)
+    {
+        args[i].state = &s;
+        args[i].id = i;
+        pthread_create(tids + i, NULL, run<C>, args + i);
+    }
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = now_ns() - start;
+
+    report(name, (double)iters * threads, elapsed);
+    if (misses >= 0 && refs >= 0)
+    {
+        long long miss_count = 0, ref_count = 0;
+        ::read(misses, &miss_count, sizeof(miss_count));
+        ::read(refs, &ref_count, sizeof(ref_count));
+        printf("    sizeof=%zu cache misses %lld (%.3f per op), miss rate %.2f%%\n", sizeof(C), miss_count,
+               (double)miss_count / ((double)iters * threads), ref_count ? 100.0 * miss_count / ref_count : 0.0);
+        close(misses);
+        close(refs);
+    }
+    else
+    {
+        printf("    sizeof=%zu (hardware cache counters unavailable)\n", sizeof(C));
+    }
+
+    delete[] tids;
+    delete[] args;
+    delete[] conns;
+}
+
+int main(int argc, char *argv[])
+{
+    int workers = argc > 1 ? atoi(argv[1]) : 8;
+    long iters = argc > 2 ? atol(argv[2]) : 20000000;
+    printf("%d worker threads + 1 reactor thread, %ld steps per thread, %ld online CPUs\n",
+           workers, iters, sysconf(_SC_NPROCESSORS_ONLN));
+
+    bench<legacy_conn>("legacy layout", workers, iters);
+    bench<aligned_conn>("cache-line aligned layout", workers, iters);
+    return 0;
+}
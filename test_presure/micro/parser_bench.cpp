@@ -0,0 +1,289 @@
+// 请求解析的微基准测试：对比原来逐字节查找\r\n再用strncasecmp比较字段名的做法，
+// 和扫描器一次遍历建立行索引(逐字节、SSE4.2、AVX2三种实现)的做法，以及不修改缓冲区、用完美哈希分派字段的做法
+// 编译: g++ -O2 parser_bench.cpp ../../http_scan.cpp -o parser_bench
+// 用法: ./parser_bench [迭代次数]
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <x86intrin.h>
+#include "bench.h"
+#include "../../http_scan.h"
+#include "../../http_headers.h"
+
+// 浏览器发出的典型请求
+static const char REQUEST[] =
+    "GET /images/image1.jpg HTTP/1.1\r\n"
+    "Host: 192.168.1.10:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://192.168.1.10:9006/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; _ga=GA1.1.1234567890.1697000000\r\n"
+    "\r\n";
+
+// 解析的结果，防止被优化掉
+struct result
+{
+    int lines;
+    int linger;
+    int content_length;
+    const char *host;
+};
+
+// 原来的做法：逐字节找\r\n并写入\0，再对每个头部依次strncasecmp
+static void parse_legacy(char *buf, int len, result *r)
+{
+    int checked = 0, start = 0;
+    r->lines = 0;
+    while (checked < len)
+    {
+        char c = buf[checked];
+        if (c == '\r' && checked + 1 < len && buf[checked + 1] == '\n')
+        {
+            buf[checked++] = '\0';
+            buf[checked++] = '\0';
+            char *text = buf + start;
+            start = checked;
+            ++r->lines;
+            if (r->lines == 1 || text[0] == '\0')
+            {
+                continue;
+            }
+            if (strncasecmp(text, "Connection:", 11) == 0)
+            {
+                text += 11;
+                text += strspn(text, " \t");
+                r->linger = strcasecmp(text, "keep-alive") == 0;
+            }
+            else if (strncasecmp(text, "Content-Length:", 15) == 0)
+            {
+                text += 15;
+                text += strspn(text, " \t");
+                r->content_length = atol(text);
+            }
+            else if (strncasecmp(text, "Host:", 5) == 0)
+            {
+                text += 5;
+                text += strspn(text, " \t");
+                r->host = text;
+            }
+        }
+        else
+        {
+            ++checked;
+        }
+    }
+}
+
+// 新的做法：扫描器建立行索引，按冒号位置得到字段名长度后再比较
+static void parse_scan(scan_lines_func scan, char *buf, int len, result *r)
+{
+    scan_line lines[16];
+    int pos = 0, start = 0;
+    r->lines = 0;
+    int n;
+    while ((n = scan(buf, &pos, len, lines, 16)) > 0)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            buf[lines[i].end - 1] = '\0';
+            buf[lines[i].end] = '\0';
+            char *text = buf + start;
+            start = lines[i].end + 1;
+            ++r->lines;
+            if (r->lines == 1 || text[0] == '\0' || lines[i].colon < 0)
+            {
+                continue;
+            }
+            int name_len = buf + lines[i].colon - text;
+            char *value = buf + lines[i].colon + 1;
+            value += strspn(value, " \t");
+            if (name_len == 10 && strncasecmp(text, "Connection", 10) == 0)
+            {
+                r->linger = strcasecmp(value, "keep-alive") == 0;
+            }
+            else if (name_len == 14 && strncasecmp(text, "Content-Length", 14) == 0)
+            {
+                r->content_length = atol(value);
+            }
+            else if (name_len == 4 && strncasecmp(text, "Host", 4) == 0)
+            {
+                r->host = value;
+            }
+        }
+    }
+}
+
+// 不修改缓冲区的做法：行和字段都只记录位置，字段名通过完美哈希分派
+static void parse_span(scan_lines_func scan, const char *buf, int len, result *r)
+{
+    scan_line lines[16];
+    http_span known[HEADER_COUNT];
+    int pos = 0, start = 0;
+    r->lines = 0;
+    int n;
+    while ((n = scan(buf, &pos, len, lines, 16)) > 0)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            const char *text = buf + start;
+            const char *end = buf + lines[i].end - 1;
+            start = lines[i].end + 1;
+            ++r->lines;
+            if (r->lines == 1 || end == text || lines[i].colon < 0)
+            {
+                continue;
+            }
+            const char *value = buf + lines[i].colon + 1;
+            while (value < end && *value == ' ')
+            {
+                ++value;
+            }
+            header_id id = lookup_header(text, buf + lines[i].colon - text);
+            if (id == HEADER_UNKNOWN)
+            {
+                continue;
+            }
+            known[id].off = value - buf;
+            known[id].len = end - value;
+            if (id == HEADER_CONNECTION)
+            {
+                r->linger = end - value == 10 && strncasecmp(value, "keep-alive", 10) == 0;
+            }
+            else if (id == HEADER_HOST)
+            {
+                r->host = value;
+            }
+        }
+    }
+    do_not_optimize(known[0]);
+}
+
+// 只扫描行，不做解析
+static int scan_only(scan_lines_func scan, const char *buf, int len)
+{
+    scan_line lines[16];
+    int pos = 0, total = 0, n;
+    while ((n = scan(buf, &pos, len, lines, 16)) > 0)
+    {
+        total += n;
+    }
+    return total;
+}
+
+// 原来parse_line的逐字节循环，只数行数
+static int find_lines_legacy(const char *buf, int len)
+{
+    int lines = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        char c = buf[i];
+        if (c == '\r')
+        {
+            if (i + 1 < len && buf[i + 1] == '\n')
+            {
+                ++lines;
+                ++i;
+            }
+        }
+        else if (c == '\n')
+        {
+            return -1;
+        }
+    }
+    return lines;
+}
+
+static void report_cycles(const char *name, long iters, int len, double ns, unsigned long long cycles)
+{
+    printf("%-32s %8.1f ns/req %8.0f cycles/req %6.2f bytes/cycle\n",
+           name, ns / iters, (double)cycles / iters, (double)len * iters / cycles);
+}
+
+int main(int argc, char *argv[])
+{
+    long iters = argc > 1 ? atol(argv[1]) : 2000000;
+    int len = sizeof(REQUEST) - 1;
+    char buf[sizeof(REQUEST)];
+    result r;
+    memset(&r, 0, sizeof(r));
+
+    printf("request %d bytes, %ld iterations, dispatch picks %s\n", len, iters, scan_lines_impl());
+
+    struct
+    {
+        const char *name;
+        scan_lines_func func;
+    } impls[] = {{"scalar", scan_lines_scalar}, {"sse4.2", scan_lines_sse42}, {"avx2", scan_lines_avx2}};
+
+    // 只找行
+    double start = now_ns();
+    unsigned long long c0 = __rdtsc();
+    for (long i = 0; i < iters; ++i)
+    {
+        do_not_optimize(find_lines_legacy(REQUEST, len));
+    }
+    report_cycles("lines: legacy byte loop", iters, len, now_ns() - start, __rdtsc() - c0);
+    for (int k = 0; k < 3; ++k)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "lines: scan %s", impls[k].name);
+        start = now_ns();
+        c0 = __rdtsc();
+        for (long i = 0; i < iters; ++i)
+        {
+            do_not_optimize(scan_only(impls[k].func, REQUEST, len));
+        }
+        report_cycles(name, iters, len, now_ns() - start, __rdtsc() - c0);
+    }
+
+    // 完整的解析，每次都要恢复被写入\0的缓冲区，两种做法的这部分开销相同
+    start = now_ns();
+    c0 = __rdtsc();
+    for (long i = 0; i < iters; ++i)
+    {
+        memcpy(buf, REQUEST, len);
+        parse_legacy(buf, len, &r);
+        do_not_optimize(r);
+    }
+    report_cycles("parse: legacy", iters, len, now_ns() - start, __rdtsc() - c0);
+    for (int k = 0; k < 3; ++k)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "parse: scan %s", impls[k].name);
+        start = now_ns();
+        c0 = __rdtsc();
+        for (long i = 0; i < iters; ++i)
+        {
+            memcpy(buf, REQUEST, len);
+            parse_scan(impls[k].func, buf, len, &r);
+            do_not_optimize(r);
+        }
+        report_cycles(name, iters, len, now_ns() - start, __rdtsc() - c0);
+    }
+
+    // 不修改缓冲区，也就不需要每次恢复
+    for (int k = 0; k < 3; ++k)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "parse: span+hash %s", impls[k].name);
+        start = now_ns();
+        c0 = __rdtsc();
+        for (long i = 0; i < iters; ++i)
+        {
+            parse_span(impls[k].func, REQUEST, len, &r);
+            do_not_optimize(r);
+        }
+        report_cycles(name, iters, len, now_ns() - start, __rdtsc() - c0);
+    }
+    printf("lines=%d linger=%d\n", r.lines, r.linger);
+    return 0;
+}
@@ -0,0 +1,296 @@
+// 线程池任务队列的微基准测试：对比原来的 std::list + 互斥锁 + 信号量 的实现、
+// 无锁环形队列 + eventcount 的实现和工作窃取调度。
+// 除了吞吐量，还测量1~64个生产者线程下append的往返延迟：生产者append一个任务后等待工作线程执行完，
+// 和reactor把连接交给线程池、工作线程开始处理的过程相同，输出延迟的分位数
+// 编译: g++ -O2 threadpool_bench.cpp ../../log.cpp -o threadpool_bench -pthread
+// 用法: ./threadpool_bench [任务数] [工作线程数] [生产者线程数] [每个生产者的往返次数]
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <list>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "bench.h"
+#include "../../threadpool.h"
+
+// 原来的线程池，保留下来作为对照
+template <typename T>
+class legacy_threadpool
+{
+public:
+    legacy_threadpool(int thread_number, int max_requests) : m_max_requests(max_requests), m_stop(false)
+    {
+        for (int i = 0; i < thread_number; ++i)
+        {
+            pthread_t tid;
+            pthread_create(&tid, NULL, worker, this);
+            pthread_detach(tid);
+        }
+    }
+
+    bool append(T *request)
+    {
+        m_queuelocker.lock();
+        if ((int)m_workqueue.size() > m_max_requests)
+        {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+
+private:
+    static void *worker(void *arg)
+    {
+        ((legacy_threadpool *)arg)->run();
+        return arg;
+    }
+
+    void run()
+    {
+        while (!m_stop)
+        {
+            m_queuestat.wait();
+            m_queuelocker.lock();
+            if (m_workqueue.empty())
+            {
+                m_queuelocker.unlock();
+                continue;
+            }
+            T *request = m_workqueue.front();
+            m_workqueue.pop_front();
+            m_queuelocker.unlock();
+            if (request)
+            {
+                request->process();
+            }
+        }
+    }
+
+    int m_max_requests;
+    std::list<T *> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+    bool m_stop;
+};
+
+// 测试用的任务，只把完成计数加一
+struct task
+{
+    task() : m_worker(-1) {}
+    std::atomic<long> *done;
+    int m_worker;
+    void process()
+    {
+        done->fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+template <typename POOL>
+struct producer_arg
+{
+    POOL *pool;
+    task *t;
+    long count;
+};
+
+template <typename POOL>
+static void *produce(void *arg)
+{
+    producer_arg<POOL> *p = (producer_arg<POOL> *)arg;
+    for (long i = 0; i < p->count; ++i)
+    {
+        // 队列满时让出CPU再重试
+        while (!p->pool->append(p->t))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// 用producers个线程向pool添加total个任务，测量从开始添加到全部处理完的时间
+template <typename POOL>
+static void run_pool(const char *name, POOL *pool, long total, int producers)
+{
+    std::atomic<long> done(0);
+    task t;
+    t.done = &done;
+
+    pthread_t *tids = new pthread_t[producers];
+    producer_arg<POOL> *args = new producer_arg<POOL>[producers];
+    double start = now_ns();
+    for (int i = 0; i < producers; ++i)
+    {
+        args[i].pool = pool;
+        args[i].t = &t;
+        args[i].count = total / producers;
+        pthread_create(&tids[i], NULL, produce<POOL>, &args[i]);
+    }
+    for (int i = 0; i < producers; ++i)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    long expect = total / producers * producers;
+    while (done.load(std::memory_order_relaxed) < expect)
+    {
+        sched_yield();
+    }
+    report(name, expect, now_ns() - start);
+    delete[] tids;
+    delete[] args;
+}
+
+// 往返测试的任务：工作线程执行时置位done，生产者等待它被置位
+struct rtt_task
+{
+    rtt_task() : m_worker(-1), done(false) {}
+    int m_worker;
+    std::atomic<bool> done;
+    void process()
+    {
+        done.store(true, std::memory_order_release);
+    }
+};
+
+template <typename POOL>
+struct rtt_arg
+{
+    POOL *pool;
+    long count;
+    std::vector<double> latency;
+};
+
+template <typename POOL>
+static void *rtt_produce(void *arg)
+{
+    rtt_arg<POOL> *p = (rtt_arg<POOL> *)arg;
+    rtt_task t;
+    p->latency.reserve(p->count);
+    for (long i = 0; i < p->count; ++i)
+    {
+        t.done.store(false, std::memory_order_relaxed);
+        double start = now_ns();
+        while (!p->pool->append(&t))
+        {
+            sched_yield();
+        }
+        while (!t.done.load(std::memory_order_acquire))
+        {
+            // 生产者线程数超过CPU数时，自旋会挡住工作线程
+            sched_yield();
+        }
+        p->latency.push_back(now_ns() - start);
+    }
+    return NULL;
+}
+
+// producers个线程各自append后等待任务执行完，统计往返延迟
+template <typename POOL>
+static void run_rtt(const char *name, POOL *pool, int producers, long count)
+{
+    pthread_t *tids = new pthread_t[producers];
+    rtt_arg<POOL> *args = new rtt_arg<POOL>[producers];
+    double start = now_ns();
+    for (int i = 0; i < producers; ++i)
+    {
+        args[i].pool = pool;
+        args[i].count = count;
+        pthread_create(&tids[i], NULL, rtt_produce<POOL>, &args[i]);
+    }
+    std::vector<double> all;
+    for (int i = 0; i < producers; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        all.insert(all.end(), args[i].latency.begin(), args[i].latency.end());
+    }
+    double elapsed = now_ns() - start;
+    std::sort(all.begin(), all.end());
+    size_t n = all.size();
+    printf("%-28s producers=%-3d %10.0f ops/s  p50 %8.0f ns  p99 %8.0f ns  p99.9 %9.0f ns  max %9.0f ns\n", name,
+           producers, n * 1e9 / elapsed, all[n / 2], all[n * 99 / 100], all[n * 999 / 1000], all[n - 1]);
+    delete[] tids;
+    delete[] args;
+}
+
+// 只测试队列本身：单线程交替入队出队
+static void run_queue_uncontended(long total)
+{
+    std::list<int *> list;
+    locker lock;
+    int x = 0;
+    double start = now_ns();
+    for (long i = 0; i < total; ++i)
+    {
+        lock.lock();
+        list.push_back(&x);
+        lock.unlock();
+        lock.lock();
+        int *p = list.front();
+        list.pop_front();
+        lock.unlock();
+        do_not_optimize(p);
+    }
+    report("list+mutex push/pop", total, now_ns() - start);
+
+    mpmc_queue<int *> queue(1024);
+    start = now_ns();
+    for (long i = 0; i < total; ++i)
+    {
+        queue.push(&x);
+        int *p = NULL;
+        queue.pop(p);
+        do_not_optimize(p);
+    }
+    report("mpmc_queue push/pop", total, now_ns() - start);
+
+    int *batch[16];
+    start = now_ns();
+    for (long i = 0; i < total; i += 16)
+    {
+        for (int j = 0; j < 16; ++j)
+        {
+            queue.push(&x);
+        }
+        size_t n = queue.pop_batch(batch, 16);
+        do_not_optimize(n);
+    }
+    report("mpmc_queue push x16 + pop_batch", total, now_ns() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 2000000;
+    int workers = argc > 2 ? atoi(argv[2]) : 8;
+    int producers = argc > 3 ? atoi(argv[3]) : 2;
+    long rtt_count = argc > 4 ? atol(argv[4]) : 20000;
+
+    printf("tasks=%ld workers=%d producers=%d\n", total, workers, producers);
+    run_queue_uncontended(total);
+
+    // 线程池不会退出，测试结束时随进程一起销毁
+    legacy_threadpool<task> *legacy = new legacy_threadpool<task>(workers, 10000);
+    run_pool("legacy threadpool (list+mutex+sem)", legacy, total, producers);
+
+    threadpool<task> *pool = new threadpool<task>(workers, 10000);
+    run_pool("threadpool (mpmc_queue+eventcount)", pool, total, producers);
+
+    threadpool<task> *stealing = new threadpool<task>(workers, 10000, SCHEDULE_STEALING);
+    run_pool("threadpool (work stealing)", stealing, total, producers);
+
+    printf("\nappend round trip, %ld per producer\n", rtt_count);
+    legacy_threadpool<rtt_task> *legacy_rtt = new legacy_threadpool<rtt_task>(workers, 10000);
+    threadpool<rtt_task> *pool_rtt = new threadpool<rtt_task>(workers, 10000);
+    threadpool<rtt_task> *stealing_rtt = new threadpool<rtt_task>(workers, 10000, SCHEDULE_STEALING);
+    for (int n = 1; n <= 64; n *= 2)
+    {
+        run_rtt("legacy threadpool", legacy_rtt, n, rtt_count);
+        run_rtt("threadpool", pool_rtt, n, rtt_count);
+        run_rtt("threadpool (work stealing)", stealing_rtt, n, rtt_count);
+    }
+    return 0;
+}
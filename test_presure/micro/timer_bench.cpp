@@ -0,0 +1,213 @@
+// 定时器的微基准测试：对比升序链表sort_timer_lst和分层时间轮timing_wheel在不同定时器数量下的开销。
+// 模拟长连接服务器：每个连接一个空闲超时定时器，连接上每次有数据都把它的超时时间推迟到now + TIMEOUT。
+// 两种实现都由同一个模拟的时钟驱动(sort_timer_lst::tick(cur)和timing_wheel::advance(now))，测试结果不受真实时间影响。
+//   add     : 添加定时器，超时时间均匀分布在[now + 1, now + TIMEOUT]
+//   refresh : 随机选一个连接，把它的超时时间推迟到now + TIMEOUT
+//   cancel  : 随机删除定时器
+//   expire  : 时钟走过TIMEOUT个tick，处理所有到期的定时器
+// 链表的add和refresh是O(n)的，定时器很多时只测试有限的次数，按平均值计算每次操作的耗时。
+// 编译: g++ -O2 timer_bench.cpp -o timer_bench
+// 用法: ./timer_bench [最大定时器数，默认1000000]
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "bench.h"
+#include "../../noactive/lst_timer.h"
+#include "../../timing_wheel.h"
+
+// 空闲超时，单位为tick
+static const long TIMEOUT = 1000;
+// 链表每轮测试最多访问的节点数，决定O(n)操作的测试次数
+static const double LIST_VISIT_BUDGET = 2e7;
+
+// 模拟的时钟，基准测试手动推进
+struct fake_clock
+{
+    long now;
+};
+
+static long expired_count = 0;
+
+static void count_expired(client_data *)
+{
+    ++expired_count;
+}
+
+static void count_wheel_expired(wheel_timer *)
+{
+    ++expired_count;
+}
+
+// 0到n-1之间的伪随机数
+static inline unsigned next_rand(unsigned long long &state, unsigned n)
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)(state >> 33) % n;
+}
+
+static void bench_list(int n)
+{
+    char name[64];
+    fake_clock clock = {1000000};
+    unsigned long long seed = 42;
+
+    std::vector<long> expires(n);
+    for (int i = 0; i < n; ++i)
+    {
+        expires[i] = clock.now + 1 + next_rand(seed, TIMEOUT);
+    }
+
+    // 建立n个定时器的链表。节点按连接的顺序分配，和连接对象一样在内存中的顺序与超时时间无关；
+    // 按超时时间降序添加，每次都插入到链表头部，避免O(n^2)的建立过程
+    sort_timer_lst lst;
+    std::vector<util_timer *> timers(n);
+    std::vector<int> order(n);
+    for (int i = 0; i < n; ++i)
+    {
+        timers[i] = new util_timer;
+        timers[i]->expire = expires[i];
+        timers[i]->cb_func = count_expired;
+        timers[i]->user_data = NULL;
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return expires[a] > expires[b]; });
+    for (int k = 0; k < n; ++k)
+    {
+        lst.add_timer(timers[order[k]]);
+    }
+
+    // add：往n个定时器的链表中再添加，每次从头遍历，平均访问n/2个节点，只测试一部分，测完删除
+    int add_ops = std::min<double>(n, std::max(20.0, LIST_VISIT_BUDGET / (n / 2 + 1)));
+    {
+        std::vector<util_timer *> added(add_ops);
+        for (int i = 0; i < add_ops; ++i)
+        {
+            added[i] = new util_timer;
+            added[i]->expire = clock.now + 1 + next_rand(seed, TIMEOUT);
+            added[i]->cb_func = count_expired;
+            added[i]->user_data = NULL;
+        }
+        double start = now_ns();
+        for (int i = 0; i < add_ops; ++i)
+        {
+            lst.add_timer(added[i]);
+        }
+        snprintf(name, sizeof(name), "list   add     n=%d", n);
+        report(name, add_ops, now_ns() - start);
+        for (int i = 0; i < add_ops; ++i)
+        {
+            lst.del_timer(added[i]);
+        }
+    }
+
+    // refresh：推迟到链表尾部，平均从中间遍历到尾部
+    int refresh_ops = std::min<double>(1000000, std::max(20.0, LIST_VISIT_BUDGET / (n / 2 + 1)));
+    double start = now_ns();
+    for (int k = 0; k < refresh_ops; ++k)
+    {
+        util_timer *t = timers[next_rand(seed, n)];
+        t->expire = clock.now + TIMEOUT;
+        lst.adjust_timer(t);
+    }
+    snprintf(name, sizeof(name), "list   refresh n=%d", n);
+    report(name, refresh_ops, now_ns() - start);
+
+    // cancel：删除一半定时器
+    for (int i = n - 1; i > 0; --i)
+    {
+        std::swap(timers[i], timers[next_rand(seed, i + 1)]);
+    }
+    int cancel_ops = n / 2;
+    start = now_ns();
+    for (int k = 0; k < cancel_ops; ++k)
+    {
+        lst.del_timer(timers[k]);
+    }
+    snprintf(name, sizeof(name), "list   cancel  n=%d", n);
+    report(name, cancel_ops, now_ns() - start);
+
+    // expire：逐个tick推进时钟，直到剩下的定时器全部到期
+    expired_count = 0;
+    start = now_ns();
+    for (long t = 0; t <= TIMEOUT; ++t)
+    {
+        ++clock.now;
+        lst.tick(clock.now);
+    }
+    snprintf(name, sizeof(name), "list   expire  n=%d", n);
+    report(name, expired_count ? expired_count : 1, now_ns() - start);
+}
+
+static void bench_wheel(int n)
+{
+    char name[64];
+    fake_clock clock = {1000000};
+    unsigned long long seed = 42;
+
+    // 定时器节点连续分配，相当于嵌入在连接对象中
+    std::vector<wheel_timer> timers(n);
+    timing_wheel wheel(clock.now);
+
+    double start = now_ns();
+    for (int i = 0; i < n; ++i)
+    {
+        wheel.add(&timers[i], clock.now + 1 + next_rand(seed, TIMEOUT));
+    }
+    snprintf(name, sizeof(name), "wheel  add     n=%d", n);
+    report(name, n, now_ns() - start);
+
+    int refresh_ops = 1000000;
+    start = now_ns();
+    for (int k = 0; k < refresh_ops; ++k)
+    {
+        wheel.adjust(&timers[next_rand(seed, n)], clock.now + TIMEOUT);
+    }
+    snprintf(name, sizeof(name), "wheel  refresh n=%d", n);
+    report(name, refresh_ops, now_ns() - start);
+
+    std::vector<wheel_timer *> shuffled(n);
+    for (int i = 0; i < n; ++i)
+    {
+        shuffled[i] = &timers[i];
+    }
+    for (int i = n - 1; i > 0; --i)
+    {
+        std::swap(shuffled[i], shuffled[next_rand(seed, i + 1)]);
+    }
+    int cancel_ops = n / 2;
+    start = now_ns();
+    for (int k = 0; k < cancel_ops; ++k)
+    {
+        wheel.del(shuffled[k]);
+    }
+    snprintf(name, sizeof(name), "wheel  cancel  n=%d", n);
+    report(name, cancel_ops, now_ns() - start);
+
+    expired_count = 0;
+    start = now_ns();
+    for (long t = 0; t <= TIMEOUT; ++t)
+    {
+        ++clock.now;
+        wheel.advance(clock.now, count_wheel_expired);
+    }
+    snprintf(name, sizeof(name), "wheel  expire  n=%d", n);
+    report(name, expired_count ? expired_count : 1, now_ns() - start);
+    if (wheel.count() != 0)
+    {
+        printf("    error: %d timers left in the wheel\n", wheel.count());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int max_n = argc > 1 ? atoi(argv[1]) : 1000000;
+    printf("timeout %ld ticks, sizeof(util_timer)=%zu, sizeof(wheel_timer)=%zu\n",
+           TIMEOUT, sizeof(util_timer), sizeof(wheel_timer));
+    for (int n = 1000; n <= max_n; n *= 10)
+    {
+        bench_list(n);
+        bench_wheel(n);
+    }
+    return 0;
+}
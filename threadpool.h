@@ -1,16 +1,45 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 #include <pthread.h>
-#include <list>
 #include <cstdio>
+#include <unistd.h>
 #include <exception>
+#include <atomic>
 #include "lock.h"
+#include "mpmc_queue.h"
+#include "ws_deque.h"
+#include "log.h"
+
+// 线程池的任务调度策略
+enum thread_schedule
+{
+    SCHEDULE_GLOBAL,  // 所有工作线程从同一个队列中取任务
+    SCHEDULE_STEALING // 每个工作线程有自己的队列，空闲时从其他线程窃取任务
+};
+
 // 线程池类,定义成模板类是为了代码复用，模板参数T是任务类
+// 任务类需要有process()方法和int类型的成员m_worker，
+// m_worker记录上次处理该任务的工作线程，初始化为-1
 template <typename T>
 
 class threadpool
 {
 private:
+    // 工作窃取调度时每个工作线程的队列
+    struct worker_queue
+    {
+        explicit worker_queue(int capacity) : deque(MAX_BATCH), mailbox(capacity) {}
+
+        // 从信箱中取出还没有处理的任务，其他线程可以从这里窃取
+        ws_deque<T *> deque;
+
+        // 指定交给该线程处理的任务，由reactor线程写入
+        mpmc_queue<T *> mailbox;
+
+        // 该线程空闲时在这里睡眠
+        eventcount idle;
+    };
+
     // 线程池中的线程数
     int m_thread_number;
 
@@ -20,14 +49,28 @@ private:
     // 请求队列中最多允许的、等待处理的请求的数量
     int m_max_requests;
 
-    // 请求队列
-    std::list<T *> m_workqueue;
+    // 请求队列，无锁的有界环形队列，容量为m_max_requests向上取整到2的幂。
+    // 工作窃取调度时存放没有指定线程的任务
+    mpmc_queue<T *> m_workqueue;
+
+    // 空闲的工作线程在这里睡眠，有线程在自旋等待时添加任务不需要系统调用
+    eventcount m_queuestat;
+
+    // 工作线程一次最多取出的任务数
+    static const int MAX_BATCH = 16;
+
+    // 工作线程睡眠之前自旋检查队列的次数，单核机器上自旋只会占用生产者的时间，所以不自旋
+    static const int SPIN_COUNT = 128;
+    int m_spin_count;
 
-    // 保护请求队列的互斥锁
-    locker m_queuelocker;
+    // 调度策略
+    thread_schedule m_schedule;
 
-    // 是否有任务需要处理,定义信号量
-    sem m_queuestat;
+    // 工作窃取调度时每个线程的队列，大小为m_thread_number
+    worker_queue **m_workers;
+
+    // 分配工作线程的编号
+    std::atomic<int> m_next_id;
 
     // 是否结束线程
     bool m_stop;
@@ -35,10 +78,20 @@ private:
 private:
     static void *worker(void *arg);
     void run();
+    void run_stealing(int self);
+
+    // 取出一批任务，队列为空时返回0
+    int take(T **batch);
+
+    // 工作窃取调度时为线程self寻找一个任务，batch用于从信箱中批量取出任务，没有任务时返回NULL
+    T *find_task(int self, T **batch, unsigned *seed);
+
+    // 唤醒一个正在睡眠的工作线程，从except的下一个线程开始找
+    void wake_any(int except);
 
 public:
     // 构造函数
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    threadpool(int thread_number = 8, int max_requests = 10000, thread_schedule schedule = SCHEDULE_GLOBAL);
 
     // 析构函数
     ~threadpool();
@@ -48,13 +101,26 @@ public:
 };
 
 template <typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL)
+threadpool<T>::threadpool(int thread_number, int max_requests, thread_schedule schedule) : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL), m_workqueue(max_requests),
+    m_schedule(schedule), m_workers(NULL), m_next_id(0)
 {
+    m_spin_count = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+
     if ((thread_number <= 0) || (max_requests <= 0))
     {
         throw std::exception();
     }
 
+    if (m_schedule == SCHEDULE_STEALING)
+    {
+        // 每个线程的信箱平分请求队列的容量
+        m_workers = new worker_queue *[m_thread_number];
+        for (int i = 0; i < m_thread_number; ++i)
+        {
+            m_workers[i] = new worker_queue(m_max_requests / m_thread_number + 1);
+        }
+    }
+
     // 创建线程数组
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
@@ -65,7 +131,7 @@ threadpool<T>::threadpool(int thread_number, int max_requests) : m_thread_number
     // 创建thread_number个线程，并将它们都设置为脱离线程
     for (int i = 0; i < thread_number; ++i)
     {
-        printf("create the %dth thread\n", i);
+        LOG_INFO("create the %dth thread", i);
         if (pthread_create(m_threads + i, NULL, worker, this) != 0)
         {
             delete[] m_threads;
@@ -86,64 +152,230 @@ threadpool<T>::~threadpool()
 {
     delete[] m_threads;
     m_stop = true;
+    m_queuestat.notify_all();
+    if (m_workers)
+    {
+        for (int i = 0; i < m_thread_number; ++i)
+        {
+            m_workers[i]->idle.notify_all();
+        }
+    }
 }
 
 template <typename T>
 bool threadpool<T>::append(T *request)
 {
-    // 操作工作队列时一定要加锁，因为它被所有线程共享
-    m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests)
+    if (m_schedule == SCHEDULE_GLOBAL)
     {
-        m_queuelocker.unlock();
-        return false;
+        // 队列满了
+        if (!m_workqueue.push(request))
+        {
+            return false;
+        }
+
+        // 唤醒一个睡眠的工作线程，没有线程在睡眠时不进入内核
+        m_queuestat.notify();
+        return true;
     }
 
-    // 将任务添加到工作队列中
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
+    // 交还给上次处理它的线程，该连接的读写缓冲区很可能还在那个核的缓存中
+    int w = request->m_worker;
+    if (w < 0 || w >= m_thread_number || !m_workers[w]->mailbox.push(request))
+    {
+        // 新的任务或者信箱满了，放进公共队列由任意线程处理
+        if (!m_workqueue.push(request))
+        {
+            return false;
+        }
+        wake_any(w);
+        return true;
+    }
 
-    // 增加信号量的值，有任务需要处理
-    m_queuestat.post();
+    // 目标线程正忙并且已经有任务在排队时，再唤醒一个空闲线程来窃取
+    if (!m_workers[w]->idle.notify() && m_workers[w]->mailbox.size_approx() > 1)
+    {
+        wake_any(w);
+    }
     return true;
 }
 
+template <typename T>
+void threadpool<T>::wake_any(int except)
+{
+    int start = except < 0 ? 0 : except + 1;
+    for (int i = 0; i < m_thread_number; ++i)
+    {
+        int w = (start + i) % m_thread_number;
+        if (w != except && m_workers[w]->idle.notify())
+        {
+            return;
+        }
+    }
+}
+
 template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
     // 将参数强制转换为线程池对象
     threadpool *pool = (threadpool *)arg;
-    pool->run();
+    int id = pool->m_next_id.fetch_add(1);
+    if (pool->m_schedule == SCHEDULE_STEALING)
+    {
+        pool->run_stealing(id);
+    }
+    else
+    {
+        pool->run();
+    }
     return pool;
 }
 
+template <typename T>
+int threadpool<T>::take(T **batch)
+{
+    // 按线程数平分队列中的任务，避免一个线程取走所有任务而其他线程空闲
+    int n = m_workqueue.size_approx() / m_thread_number;
+    n = n < 1 ? 1 : (n > MAX_BATCH ? MAX_BATCH : n);
+    return m_workqueue.pop_batch(batch, n);
+}
+
 template <typename T>
 void threadpool<T>::run()
 {
+    T *batch[MAX_BATCH];
     while (!m_stop)
     {
-        // 等待信号量，有任务需要处理
-        m_queuestat.wait();
-        // 操作工作队列时一定要加锁，因为它被所有线程共享
-        m_queuelocker.lock();
-        if (m_workqueue.empty())
+        int n = take(batch);
+
+        // 队列为空，先自旋一会儿，任务很快到来时可以省掉一次睡眠和唤醒
+        for (int spin = 0; n == 0 && spin < m_spin_count; ++spin)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            n = take(batch);
+        }
+
+        if (n == 0)
+        {
+            // 登记为等待者之后再检查一次队列，防止错过登记之前添加的任务
+            unsigned epoch = m_queuestat.prepare_wait();
+            n = take(batch);
+            if (n == 0)
+            {
+                if (m_stop)
+                {
+                    m_queuestat.cancel_wait();
+                    break;
+                }
+                m_queuestat.wait(epoch);
+                continue;
+            }
+            m_queuestat.cancel_wait();
+        }
+
+        // 处理任务
+        for (int i = 0; i < n; ++i)
+        {
+            if (batch[i])
+            {
+                batch[i]->process();
+            }
+        }
+    }
+}
+
+template <typename T>
+T *threadpool<T>::find_task(int self, T **batch, unsigned *seed)
+{
+    worker_queue *q = m_workers[self];
+
+    // 先处理自己的双端队列，后进先出
+    T *request = q->deque.pop();
+    if (request)
+    {
+        return request;
+    }
+
+    // 再从自己的信箱和公共队列中取出一批，第一个立即处理，其余放进双端队列供其他线程窃取
+    int n = q->mailbox.pop_batch(batch, MAX_BATCH);
+    if (n == 0)
+    {
+        n = take(batch);
+    }
+    if (n > 0)
+    {
+        // 双端队列刚刚为空，容量为MAX_BATCH，一定放得下
+        for (int i = n - 1; i > 0; --i)
+        {
+            q->deque.push(batch[i]);
+        }
+        if (n > 1)
+        {
+            wake_any(self);
+        }
+        return batch[0];
+    }
+
+    // 最后从随机选择的线程开始，依次窃取其他线程的双端队列和信箱
+    *seed = *seed * 1103515245 + 12345;
+    int start = (*seed >> 16) % m_thread_number;
+    for (int i = 0; i < m_thread_number; ++i)
+    {
+        int victim = (start + i) % m_thread_number;
+        if (victim == self)
         {
-            m_queuelocker.unlock();
             continue;
         }
+        request = m_workers[victim]->deque.steal();
+        if (request || m_workers[victim]->mailbox.pop(request))
+        {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+template <typename T>
+void threadpool<T>::run_stealing(int self)
+{
+    worker_queue *q = m_workers[self];
+    T *batch[MAX_BATCH];
+    unsigned seed = self * 2654435761u + 1;
+    while (!m_stop)
+    {
+        T *request = find_task(self, batch, &seed);
+
+        for (int spin = 0; !request && spin < m_spin_count; ++spin)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            request = find_task(self, batch, &seed);
+        }
 
-        // 取出任务队列中的第一个任务
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
         if (!request)
         {
-            continue;
+            // 登记为等待者之后再找一次，防止错过登记之前交给自己的任务
+            unsigned epoch = q->idle.prepare_wait();
+            request = find_task(self, batch, &seed);
+            if (!request)
+            {
+                if (m_stop)
+                {
+                    q->idle.cancel_wait();
+                    break;
+                }
+                q->idle.wait(epoch);
+                continue;
+            }
+            q->idle.cancel_wait();
         }
 
-        // 处理任务
+        // 记录处理该任务的线程，下次由reactor交还给这个线程
+        request->m_worker = self;
         request->process();
     }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,245 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <stddef.h>
+
+// 分层时间轮。时间以tick为单位，由调用者通过advance()传入当前的tick，时间轮本身不读时钟，
+// 因此既可以由真实时钟驱动，也可以在测试中由模拟的时钟驱动。
+// 第0层有256个槽，每个槽1个tick；后面三层各有64个槽，每个槽分别覆盖256、2^14、2^20个tick，
+// 总共可以表示2^26个tick之内的超时，更远的超时按最大值处理。
+// 每个槽是一个带哨兵的双向循环链表，添加、刷新和删除定时器都是O(1)，
+// 不需要像sort_timer_lst那样遍历链表寻找插入位置。
+// 第0层转完一圈时，把上一层对应槽中的定时器重新分配到下面的层中(级联)
+
+// 定时器节点，嵌入在使用者的对象中，不单独分配内存
+struct wheel_timer
+{
+    wheel_timer() : prev(NULL), next(NULL), expire(0), data(NULL) {}
+
+    // 是否在时间轮中
+    bool pending() const { return next != NULL; }
+
+    wheel_timer *prev;
+    wheel_timer *next;
+    unsigned long long expire; // 到期的tick，绝对时间
+    void *data;                // 使用者的数据，到期时通过它找到所属的对象
+};
+
+class timing_wheel
+{
+public:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int ROOT_SIZE = 1 << ROOT_BITS;
+    static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const int LEVELS = 3; // 第0层之外的层数
+    static const unsigned long long MAX_TIMEOUT = (1ULL << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1;
+
+    // now为当前的tick，之后从它开始推进
+    explicit timing_wheel(unsigned long long now = 0) : m_current(now), m_count(0)
+    {
+        for (int i = 0; i < ROOT_SIZE; ++i)
+        {
+            init_slot(&m_root[i]);
+        }
+        for (int l = 0; l < LEVELS; ++l)
+        {
+            for (int i = 0; i < LEVEL_SIZE; ++i)
+            {
+                init_slot(&m_levels[l][i]);
+            }
+        }
+    }
+
+    // 定时器属于使用者，析构时只是把还在时间轮中的定时器摘下来
+    ~timing_wheel()
+    {
+        clear();
+    }
+
+    // 时间轮中的定时器数
+    int count() const { return m_count; }
+
+    // 下一个还没有处理的tick
+    unsigned long long current() const { return m_current; }
+
+    // 添加定时器，expire为到期的tick，已经过期的定时器在下次advance()时到期。定时器已经在时间轮中时先删除
+    void add(wheel_timer *timer, unsigned long long expire)
+    {
+        if (timer->pending())
+        {
+            unlink(timer);
+        }
+        else
+        {
+            ++m_count;
+        }
+        timer->expire = expire;
+        place(timer);
+    }
+
+    // 刷新定时器的到期时间
+    void adjust(wheel_timer *timer, unsigned long long expire) { add(timer, expire); }
+
+    // 删除定时器，不在时间轮中时什么也不做
+    void del(wheel_timer *timer)
+    {
+        if (timer->pending())
+        {
+            unlink(timer);
+            --m_count;
+        }
+    }
+
+    // 推进到now，依次处理now及之前到期的定时器：先从时间轮中删除，再调用expired(timer)。
+    // 回调中可以重新添加或者删除任意定时器。返回到期的定时器数
+    template <typename F>
+    int advance(unsigned long long now, F expired)
+    {
+        int fired = 0;
+        while (m_current <= now)
+        {
+            // 时间轮为空时直接跳到now之后
+            if (m_count == 0)
+            {
+                m_current = now + 1;
+                break;
+            }
+            int index = m_current & (ROOT_SIZE - 1);
+            // 第0层转完一圈，从上一层取出接下来256个tick内到期的定时器
+            if (index == 0)
+            {
+                for (int l = 0; l < LEVELS && cascade(l) == 0; ++l)
+                {
+                }
+            }
+            // 先把这个槽整个摘到局部链表中，回调添加的定时器不会在这一轮中被处理
+            wheel_timer due;
+            init_slot(&due);
+            splice(&m_root[index], &due);
+            ++m_current;
+            while (due.next != &due)
+            {
+                wheel_timer *timer = due.next;
+                unlink(timer);
+                --m_count;
+                ++fired;
+                expired(timer);
+            }
+        }
+        return fired;
+    }
+
+    // 删除所有定时器
+    void clear()
+    {
+        for (int i = 0; i < ROOT_SIZE; ++i)
+        {
+            clear_slot(&m_root[i]);
+        }
+        for (int l = 0; l < LEVELS; ++l)
+        {
+            for (int i = 0; i < LEVEL_SIZE; ++i)
+            {
+                clear_slot(&m_levels[l][i]);
+            }
+        }
+        m_count = 0;
+    }
+
+private:
+    static void init_slot(wheel_timer *slot)
+    {
+        slot->prev = slot->next = slot;
+    }
+
+    static void link(wheel_timer *slot, wheel_timer *timer)
+    {
+        timer->prev = slot->prev;
+        timer->next = slot;
+        slot->prev->next = timer;
+        slot->prev = timer;
+    }
+
+    static void unlink(wheel_timer *timer)
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = timer->next = NULL;
+    }
+
+    // 把from中的所有节点移到空链表to中
+    static void splice(wheel_timer *from, wheel_timer *to)
+    {
+        if (from->next == from)
+        {
+            return;
+        }
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        init_slot(from);
+    }
+
+    void clear_slot(wheel_timer *slot)
+    {
+        while (slot->next != slot)
+        {
+            unlink(slot->next);
+        }
+    }
+
+    // 根据到期时间距离当前的tick数选择层和槽
+    void place(wheel_timer *timer)
+    {
+        unsigned long long expire = timer->expire;
+        if (expire < m_current)
+        {
+            expire = m_current;
+        }
+        unsigned long long delta = expire - m_current;
+        if (delta > MAX_TIMEOUT)
+        {
+            expire = m_current + MAX_TIMEOUT;
+            delta = MAX_TIMEOUT;
+        }
+        if (delta < (unsigned long long)ROOT_SIZE)
+        {
+            link(&m_root[expire & (ROOT_SIZE - 1)], timer);
+            return;
+        }
+        for (int l = 0; l < LEVELS; ++l)
+        {
+            int shift = ROOT_BITS + (l + 1) * LEVEL_BITS;
+            if (l == LEVELS - 1 || delta < (1ULL << shift))
+            {
+                link(&m_levels[l][(expire >> (shift - LEVEL_BITS)) & (LEVEL_SIZE - 1)], timer);
+                return;
+            }
+        }
+    }
+
+    // 把第l层中当前tick对应的槽里的定时器重新分配到下面的层，返回该槽的下标，为0时上一层也需要级联
+    int cascade(int l)
+    {
+        int index = (m_current >> (ROOT_BITS + l * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+        wheel_timer moving;
+        init_slot(&moving);
+        splice(&m_levels[l][index], &moving);
+        while (moving.next != &moving)
+        {
+            wheel_timer *timer = moving.next;
+            unlink(timer);
+            place(timer);
+        }
+        return index;
+    }
+
+    unsigned long long m_current; // 下一个要处理的tick
+    int m_count;
+    wheel_timer m_root[ROOT_SIZE];
+    wheel_timer m_levels[LEVELS][LEVEL_SIZE];
+};
+
+#endif
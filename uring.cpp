@@ -0,0 +1,631 @@
+#include "uring.h"
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <poll.h>
+
+static int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+extern bool shed_connection(int listenfd, int *spare_fd);
+
+uring_loop::uring_loop(int listenfd, conn_table *users, threadpool<http_conn> *pool, int *spare_fd, conn_timers *timers)
+    : m_listenfd(listenfd), m_spare_fd(spare_fd), m_users(users), m_max_fd(users->max_fd()), m_pool(pool),
+      m_timers(timers), m_timer_val(0), m_ringfd(-1),
+      m_sq_ptr(MAP_FAILED), m_sq_size(0), m_sqes(NULL), m_sqes_size(0),
+      m_cq_ptr(MAP_FAILED), m_cq_size(0),
+      m_buf_ring(NULL), m_buf_ring_size(0), m_bufs(NULL), m_buf_tail(0),
+      m_recv_parked_head(0),
+      m_pending(users->max_fd(), 0), m_send_failed(users->max_fd(), 0), m_eventfd(-1), m_eventfd_val(0)
+{
+}
+
+uring_loop::~uring_loop()
+{
+    if (m_ringfd >= 0)
+    {
+        close(m_ringfd);
+    }
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+    {
+        munmap(m_cq_ptr, m_cq_size);
+    }
+    if (m_sq_ptr != MAP_FAILED)
+    {
+        munmap(m_sq_ptr, m_sq_size);
+    }
+    if (m_sqes)
+    {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_buf_ring)
+    {
+        munmap(m_buf_ring, m_buf_ring_size);
+    }
+    delete[] m_bufs;
+    if (m_eventfd >= 0)
+    {
+        close(m_eventfd);
+    }
+}
+
+bool uring_loop::init()
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_ringfd = io_uring_setup(RING_ENTRIES, &p);
+    if (m_ringfd < 0)
+    {
+        return false;
+    }
+
+    // 映射提交队列和完成队列，较新的内核可以用一次mmap同时映射二者
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && m_cq_size > m_sq_size)
+    {
+        m_sq_size = m_cq_size;
+    }
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        return false;
+    }
+    if (single_mmap)
+    {
+        m_cq_ptr = m_sq_ptr;
+    }
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_local_tail = *m_sq_tail;
+
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+    m_sqes = (io_uring_sqe *)sqes;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // 缓冲区环(IORING_REGISTER_PBUF_RING)是5.19引入的，同一版本也支持多次触发的accept，
+    // 所以注册失败就说明内核太旧
+    m_buf_ring_size = BUF_COUNT * sizeof(io_uring_buf);
+    void *br = mmap(0, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED)
+    {
+        return false;
+    }
+    m_buf_ring = (io_uring_buf *)br;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)m_buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (io_uring_register(m_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        return false;
+    }
+
+    m_bufs = new char[BUF_COUNT * BUF_SIZE];
+    for (unsigned i = 0; i < BUF_COUNT; ++i)
+    {
+        recycle_buffer(i);
+    }
+
+    m_eventfd = eventfd(0, EFD_CLOEXEC);
+    return m_eventfd >= 0;
+}
+
+io_uring_sqe *uring_loop::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sq_local_tail - head >= m_sq_entries)
+    {
+        // 提交队列满了，先交给内核
+        submit(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sq_local_tail - head >= m_sq_entries)
+        {
+            return NULL;
+        }
+    }
+    unsigned idx = m_sq_local_tail & m_sq_mask;
+    io_uring_sqe *sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[idx] = idx;
+    ++m_sq_local_tail;
+    return sqe;
+}
+
+bool uring_loop::reserve_sqes(unsigned n)
+{
+    if (m_sq_entries - (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)) >= n)
+    {
+        return true;
+    }
+    submit(0);
+    return m_sq_entries - (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)) >= n;
+}
+
+int uring_loop::submit(unsigned wait_nr)
+{
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && wait_nr == 0)
+    {
+        return 0;
+    }
+    return io_uring_enter(m_ringfd, to_submit, wait_nr, flags);
+}
+
+void uring_loop::recycle_buffer(unsigned bid)
+{
+    io_uring_buf *buf = &m_buf_ring[m_buf_tail & (BUF_COUNT - 1)];
+    buf->addr = (unsigned long)(m_bufs + (size_t)bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    ++m_buf_tail;
+    // 环的尾指针与第一个缓冲区的resv字段重叠(见io_uring_buf_ring)
+    __atomic_store_n(&m_buf_ring[0].resv, m_buf_tail, __ATOMIC_RELEASE);
+    // 一个recv只占用一个缓冲区，归还一个就恢复一个等待中的连接
+    resume_recv(1);
+}
+
+void uring_loop::resume_recv(size_t count)
+{
+    while (count-- > 0 && m_recv_parked_head < m_recv_parked.size())
+    {
+        submit_recv(m_recv_parked[m_recv_parked_head++]);
+    }
+    if (m_recv_parked_head == m_recv_parked.size())
+    {
+        m_recv_parked.clear();
+        m_recv_parked_head = 0;
+    }
+}
+
+void uring_loop::submit_accept()
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = OP_ACCEPT;
+}
+
+void uring_loop::submit_recv(int fd)
+{
+    // 最多只接收读缓冲区剩余空间大小的数据，多出的数据留在socket中，
+    // 流水线中的请求处理完腾出空间之后再接收。缓冲区已满说明请求太大
+    int room = m_users->get(fd)->read_room();
+    io_uring_sqe *sqe = room > 0 ? get_sqe() : NULL;
+    if (!sqe)
+    {
+        close_conn(fd);
+        return;
+    }
+    // 不指定缓冲区，由内核在数据到达时从缓冲区组中挑选一个
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->len = room;
+    sqe->user_data = ((unsigned long long)fd << 8) | OP_RECV;
+}
+
+void uring_loop::submit_send(int fd)
+{
+    http_conn &conn = *m_users->get(fd);
+    const struct iovec *iv = conn.iov();
+    int count = 0;
+    const struct iovec *segs[http_conn::MAX_IOV];
+    for (int i = 0; i < conn.iov_count(); ++i)
+    {
+        if (iv[i].iov_len > 0)
+        {
+            segs[count++] = &iv[i];
+        }
+    }
+
+    if (count == 0 && conn.use_sendfile() && conn.bytes_left() > 0)
+    {
+        // 响应头已经发完，剩下的文件内容用sendfile发送
+        send_file(fd);
+        return;
+    }
+
+    m_send_failed[fd] = 0;
+    m_pending[fd] = 0;
+    // 链接的send必须一次放进提交队列：get_sqe()在队列满时会先提交已填写的部分，
+    // 以IOSQE_IO_LINK结尾的半条链和剩下的send之间就没有了顺序保证，响应的字节可能乱序。
+    // 放不下整条链时改用一个sendmsg发送全部iovec，短写由handle_send_done()接着发送
+    if (count > 1 && !reserve_sqes(count))
+    {
+        io_uring_sqe *sqe = get_sqe();
+        if (!sqe)
+        {
+            m_send_failed[fd] = 1;
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = fd;
+            sqe->addr = (unsigned long)conn.send_msg();
+            sqe->len = 1;
+            sqe->msg_flags = MSG_WAITALL | (conn.use_sendfile() ? MSG_MORE : 0);
+            sqe->user_data = ((unsigned long long)fd << 8) | OP_SEND;
+            ++m_pending[fd];
+        }
+        count = 0;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        io_uring_sqe *sqe = get_sqe();
+        if (!sqe)
+        {
+            m_send_failed[fd] = 1;
+            break;
+        }
+        // MSG_WAITALL让内核在短写时自行重试，短写或出错会断开链接并取消后面的send
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long)segs[i]->iov_base;
+        sqe->len = segs[i]->iov_len;
+        sqe->msg_flags = MSG_WAITALL;
+        if (i + 1 < count)
+        {
+            // 响应头和文件内容尽量放在同一个报文段中
+            sqe->msg_flags |= MSG_MORE;
+            sqe->flags = IOSQE_IO_LINK;
+        }
+        else if (conn.use_sendfile())
+        {
+            // 文件内容随后由sendfile发送
+            sqe->msg_flags |= MSG_MORE;
+        }
+        sqe->user_data = ((unsigned long long)fd << 8) | OP_SEND;
+        ++m_pending[fd];
+    }
+
+    if (m_pending[fd] == 0)
+    {
+        handle_send_done(fd);
+    }
+}
+
+void uring_loop::submit_poll_out(int fd)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+    {
+        close_conn(fd);
+        return;
+    }
+    // 等待可写期间按发送超时计算
+    m_users->get(fd)->set_deadline(TIMEOUT_WRITE);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = ((unsigned long long)fd << 8) | OP_POLL_OUT;
+}
+
+void uring_loop::send_file(int fd)
+{
+    http_conn &conn = *m_users->get(fd);
+    if (!conn.send_file())
+    {
+        close_conn(fd);
+    }
+    else if (conn.bytes_left() > 0)
+    {
+        // socket发送缓冲区满了，等可写后再继续
+        submit_poll_out(fd);
+    }
+    else
+    {
+        response_done(fd);
+    }
+}
+
+void uring_loop::submit_wakeup()
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_eventfd;
+    sqe->addr = (unsigned long)&m_eventfd_val;
+    sqe->len = sizeof(m_eventfd_val);
+    sqe->user_data = OP_WAKEUP;
+}
+
+void uring_loop::submit_timer()
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_timers->fd();
+    sqe->addr = (unsigned long)&m_timer_val;
+    sqe->len = sizeof(m_timer_val);
+    sqe->user_data = OP_TIMER;
+}
+
+void uring_loop::post(http_conn *conn, int ev)
+{
+    m_posted_locker.lock();
+    m_posted.push_back(std::make_pair(conn, ev));
+    m_posted_locker.unlock();
+
+    unsigned long long one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+}
+
+void uring_loop::drain_posted()
+{
+    std::vector<std::pair<http_conn *, int> > posted;
+    m_posted_locker.lock();
+    posted.swap(m_posted);
+    m_posted_locker.unlock();
+
+    for (size_t i = 0; i < posted.size(); ++i)
+    {
+        int fd = posted[i].first->sockfd();
+        if (posted[i].second & EPOLLOUT)
+        {
+            submit_send(fd);
+        }
+        else
+        {
+            submit_recv(fd);
+        }
+    }
+}
+
+void uring_loop::close_conn(int fd)
+{
+    m_pending[fd] = 0;
+    m_send_failed[fd] = 0;
+    m_users->get(fd)->close_conn();
+}
+
+void uring_loop::dispatch(int fd)
+{
+    http_conn *conn = m_users->get(fd);
+    conn->queued();
+    if (!m_pool->append(conn))
+    {
+        metrics::count(COUNTER_QUEUE_REJECTIONS);
+        close_conn(fd);
+    }
+}
+
+void uring_loop::handle_send_done(int fd)
+{
+    http_conn &conn = *m_users->get(fd);
+    if (m_send_failed[fd])
+    {
+        close_conn(fd);
+    }
+    else if (conn.bytes_left() > 0)
+    {
+        // 还有数据没有发出去，接着发送剩下的部分
+        submit_send(fd);
+    }
+    else
+    {
+        response_done(fd);
+    }
+}
+
+void uring_loop::response_done(int fd)
+{
+    http_conn &conn = *m_users->get(fd);
+    if (!conn.finish_response())
+    {
+        close_conn(fd);
+    }
+    else if (conn.pipelined())
+    {
+        // 读缓冲区中还有流水线请求，直接交给线程池
+        dispatch(fd);
+    }
+    else
+    {
+        submit_recv(fd);
+    }
+}
+
+void uring_loop::handle_cqe(const io_uring_cqe *cqe)
+{
+    int op = cqe->user_data & 0xff;
+    int fd = cqe->user_data >> 8;
+    int res = cqe->res;
+
+    switch (op)
+    {
+    case OP_ACCEPT:
+    {
+        if (res >= 0)
+        {
+            if (res >= m_max_fd || http_conn::m_user_count >= m_max_fd)
+            {
+                close(res);
+            }
+            else
+            {
+                struct sockaddr_in client_address;
+                socklen_t client_addrlength = sizeof(client_address);
+                memset(&client_address, '\0', sizeof(client_address));
+                getpeername(res, (struct sockaddr *)&client_address, &client_addrlength);
+                m_users->get(res)->init(res, client_address, -1, m_timers, this);
+                submit_recv(res);
+            }
+        }
+        else if (res == -EMFILE || res == -ENFILE)
+        {
+            // 文件描述符耗尽，多次触发的accept会终止，丢弃一个连接后再重新提交，
+            // 否则重新提交的accept会立即以同样的错误完成
+            shed_connection(m_listenfd, m_spare_fd);
+        }
+        else
+        {
+            LOG_ERROR("accept failed, errno is: %d", -res);
+        }
+        // 没有IORING_CQE_F_MORE标志说明多次触发的accept已经结束，需要重新提交
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            submit_accept();
+        }
+        break;
+    }
+    case OP_RECV:
+    {
+        if (res == -ENOBUFS)
+        {
+            // 缓冲区暂时用完了。立即重新提交只会马上以同样的错误完成，让reactor空转，
+            // 先记下连接，等recycle_buffer()归还缓冲区时再读
+            metrics::count(COUNTER_RECV_NOBUFS);
+            m_recv_parked.push_back(fd);
+        }
+        else if (res <= 0)
+        {
+            // 对方关闭了连接或者出错
+            close_conn(fd);
+        }
+        else
+        {
+            unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            bool ok = m_users->get(fd)->feed(m_bufs + (size_t)bid * BUF_SIZE, res);
+            recycle_buffer(bid);
+            if (ok)
+            {
+                dispatch(fd);
+            }
+            else
+            {
+                close_conn(fd);
+            }
+        }
+        break;
+    }
+    case OP_SEND:
+    {
+        if (res > 0)
+        {
+            m_users->get(fd)->sent(res);
+        }
+        else if (res < 0)
+        {
+            m_send_failed[fd] = 1;
+        }
+        if (--m_pending[fd] == 0)
+        {
+            handle_send_done(fd);
+        }
+        break;
+    }
+    case OP_POLL_OUT:
+    {
+        if (res < 0)
+        {
+            close_conn(fd);
+        }
+        else
+        {
+            send_file(fd);
+        }
+        break;
+    }
+    case OP_WAKEUP:
+    {
+        drain_posted();
+        submit_wakeup();
+        break;
+    }
+    case OP_TIMER:
+    {
+        // 超时的连接只是被shutdown，挂起的recv/send随之完成，由上面的路径关闭
+        m_timers->tick();
+        resume_recv(m_recv_parked.size());
+        submit_timer();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void uring_loop::run()
+{
+    submit_accept();
+    submit_wakeup();
+    submit_timer();
+
+    while (true)
+    {
+        int ret = submit(1);
+        if (ret < 0 && errno != EINTR)
+        {
+            LOG_ERROR("io_uring_enter failure, errno is: %d", errno);
+            break;
+        }
+
+        // 处理所有已完成的请求
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            handle_cqe(&m_cqes[head & m_cq_mask]);
+            ++head;
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <vector>
+#include <utility>
+#include "lock.h"
+#include "threadpool.h"
+#include "http_conn.h"
+#include "conn_table.h"
+
+// 基于io_uring的reactor，直接使用io_uring_setup/io_uring_enter系统调用，不依赖liburing。
+// 监听socket使用多次触发的accept，读使用内核从缓冲区环中挑选的缓冲区，
+// 响应头和文件内容作为两个链接在一起的send一次提交，大文件在响应头发完后由reactor直接调用sendfile发送。
+// 需要5.19及以上的内核，init()失败时调用者应回退到epoll。
+class uring_loop
+{
+public:
+    // spare_fd为reactor预留的文件描述符，文件描述符耗尽时用来丢弃连接，timers为reactor的超时管理
+    uring_loop(int listenfd, conn_table *users, threadpool<http_conn> *pool, int *spare_fd, conn_timers *timers);
+    ~uring_loop();
+
+    // 创建ring并注册缓冲区环，内核不支持时返回false
+    bool init();
+
+    // 事件循环
+    void run();
+
+    // 工作线程处理完请求后调用，通知reactor为连接提交读(EPOLLIN)或写(EPOLLOUT)请求
+    void post(http_conn *conn, int ev);
+
+private:
+    // 提交队列项中user_data的低8位表示请求类型，其余位保存文件描述符
+    enum OP_TYPE
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_POLL_OUT,
+        OP_WAKEUP,
+        OP_TIMER
+    };
+
+    static const unsigned RING_ENTRIES = 4096;
+    static const unsigned BUF_COUNT = 1024; // 缓冲区环中的缓冲区个数，必须是2的幂
+    static const unsigned BUF_SIZE = 2048;  // 每个缓冲区的大小，收到的数据随后拷贝进连接的读缓冲区
+    static const unsigned BUF_GROUP = 0;
+
+    io_uring_sqe *get_sqe();
+    // 保证提交队列至少有n个空位，必要时先把已填写的请求交给内核，做不到时返回false
+    bool reserve_sqes(unsigned n);
+    int submit(unsigned wait_nr);
+
+    void submit_accept();
+    void submit_recv(int fd);
+    void submit_send(int fd);
+    void submit_poll_out(int fd);
+    void submit_wakeup();
+    void submit_timer();
+    void send_file(int fd);
+    void recycle_buffer(unsigned bid);
+    // 重新提交等待缓冲区的连接的recv，最多count个
+    void resume_recv(size_t count);
+
+    void handle_cqe(const io_uring_cqe *cqe);
+    void handle_send_done(int fd);
+    // 一批响应发送完毕，保持连接时继续处理流水线中的请求或者重新提交recv
+    void response_done(int fd);
+    void drain_posted();
+    void close_conn(int fd);
+    // 把连接交给线程池，队列满时关闭连接
+    void dispatch(int fd);
+
+private:
+    int m_listenfd;
+    int *m_spare_fd;
+    conn_table *m_users;
+    int m_max_fd;
+    threadpool<http_conn> *m_pool;
+    conn_timers *m_timers;
+    unsigned long long m_timer_val;
+
+    int m_ringfd;
+
+    // 提交队列
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_array;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sq_local_tail; // 已填写但尚未对内核可见的提交队列尾
+    io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+
+    // 完成队列
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe *m_cqes;
+
+    // 缓冲区环。io_uring_buf_ring中的柔性数组在C++下会多出一个空结构体的偏移，所以直接按io_uring_buf数组访问
+    io_uring_buf *m_buf_ring;
+    size_t m_buf_ring_size;
+    char *m_bufs;
+    unsigned short m_buf_tail;
+    // recv因为缓冲区环用完(-ENOBUFS)而暂停的连接。它们没有挂起的请求，不会被关闭，
+    // 缓冲区归还时按先后顺序重新提交，每个定时器tick也全部重新提交一次作为保底
+    std::vector<int> m_recv_parked;
+    size_t m_recv_parked_head;
+
+    // 每个连接上尚未完成的send个数，以及这一组send中是否出错
+    std::vector<int> m_pending;
+    std::vector<char> m_send_failed;
+
+    // 工作线程投递过来的连接，通过eventfd唤醒reactor
+    int m_eventfd;
+    unsigned long long m_eventfd_val;
+    locker m_posted_locker;
+    std::vector<std::pair<http_conn *, int> > m_posted;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <atomic>
+
+// 工作窃取用的定长Chase-Lev双端队列(按Lê等人给出的C11内存序实现)。
+// 只有拥有者线程可以在底部push和pop，其他线程只能从顶部steal，
+// 拥有者的push和pop在没有竞争时只有普通的读写和一次内存屏障。
+// 元素类型T必须是指针，队列为空或窃取失败时返回NULL。
+template <typename T>
+class ws_deque
+{
+public:
+    // 容量向上取整到2的幂
+    explicit ws_deque(long capacity) : m_top(0), m_bottom(0)
+    {
+        long size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_buffer = new std::atomic<T>[size];
+    }
+
+    ~ws_deque()
+    {
+        delete[] m_buffer;
+    }
+
+    // 拥有者在底部压入，队列满时返回false
+    bool push(T x)
+    {
+        long b = m_bottom.load(std::memory_order_relaxed);
+        long t = m_top.load(std::memory_order_acquire);
+        if (b - t > m_mask)
+        {
+            return false;
+        }
+        m_buffer[b & m_mask].store(x, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 拥有者从底部弹出，后进先出，刚放进去的任务数据还在缓存中
+    T pop()
+    {
+        long b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = m_top.load(std::memory_order_relaxed);
+
+        T x = NULL;
+        if (t <= b)
+        {
+            x = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // 只剩最后一个元素，和窃取者竞争
+                if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    x = NULL;
+                }
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    // 其他线程从顶部窃取，先进先出，与其他窃取者竞争失败时也返回NULL
+    T steal()
+    {
+        long t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return NULL;
+        }
+        T x = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return NULL;
+        }
+        return x;
+    }
+
+    // 元素个数的近似值
+    long size_approx() const
+    {
+        long n = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+        return n > 0 ? n : 0;
+    }
+
+private:
+    static const int CACHELINE_SIZE = 64;
+
+    ws_deque(const ws_deque &);
+    ws_deque &operator=(const ws_deque &);
+
+private:
+    alignas(CACHELINE_SIZE) std::atomic<long> m_top; // 窃取者修改
+    alignas(CACHELINE_SIZE) std::atomic<long> m_bottom; // 拥有者修改
+    std::atomic<T> *m_buffer;
+    long m_mask;
+    char m_pad[CACHELINE_SIZE - sizeof(std::atomic<long>) - sizeof(void *) - sizeof(long)];
+};
+
+#endif